@@ -13,3 +13,10 @@ SUBDIRS = hoedown \
     src
 
 src.depends = hoedown peg-highlight
+
+# The benchmarks need QtTest and build all the sources again, so they are
+# only built with "qmake CONFIG+=benchmarks".
+CONFIG(benchmarks) {
+    SUBDIRS += benchmarks
+    benchmarks.depends = hoedown peg-highlight
+}
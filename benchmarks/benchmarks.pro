@@ -0,0 +1,64 @@
+# Benchmarks of the highlighting pipeline of the editor.
+# Run it headless with QT_QPA_PLATFORM=offscreen, which is the default.
+# Not built by default. Enable it with "qmake ../VNote.pro CONFIG+=benchmarks".
+
+QT       += core gui webenginewidgets webchannel network svg printsupport testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = vnote-benchmarks
+TEMPLATE = app
+
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+# Build all the sources of VNote but its main().
+VNOTE_SRC = $$PWD/../src
+
+VNOTE_SOURCES = $$fromfile($$VNOTE_SRC/src.pro, SOURCES)
+VNOTE_SOURCES -= main.cpp
+for(file, VNOTE_SOURCES): SOURCES += $$VNOTE_SRC/$$file
+
+VNOTE_HEADERS = $$fromfile($$VNOTE_SRC/src.pro, HEADERS)
+for(file, VNOTE_HEADERS): HEADERS += $$VNOTE_SRC/$$file
+
+VNOTE_RESOURCES = $$fromfile($$VNOTE_SRC/src.pro, RESOURCES)
+for(file, VNOTE_RESOURCES): RESOURCES += $$VNOTE_SRC/$$file
+
+INCLUDEPATH += $$VNOTE_SRC
+
+SOURCES += main.cpp \
+    vhighlighterbenchmark.cpp \
+    vbenchmarkcorpus.cpp \
+    vbenchmarkmemory.cpp
+
+HEADERS += vhighlighterbenchmark.h \
+    vbenchmarkcorpus.h \
+    vbenchmarkmemory.h
+
+win32: LIBS += -lpsapi
+
+macx {
+    LIBS += -L/usr/local/lib
+    INCLUDEPATH += /usr/local/include
+}
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../hoedown/release/ -lhoedown
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../hoedown/debug/ -lhoedown
+else:unix: LIBS += -L$$OUT_PWD/../hoedown/ -lhoedown
+
+INCLUDEPATH += $$PWD/../hoedown
+DEPENDPATH += $$PWD/../hoedown
+
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../peg-highlight/release/ -lpeg-highlight
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../peg-highlight/debug/ -lpeg-highlight
+else:unix: LIBS += -L$$OUT_PWD/../peg-highlight/ -lpeg-highlight
+
+INCLUDEPATH += $$PWD/../peg-highlight
+DEPENDPATH += $$PWD/../peg-highlight
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/release/libpeg-highlight.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/debug/libpeg-highlight.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/release/peg-highlight.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/debug/peg-highlight.lib
+else:unix: PRE_TARGETDEPS += $$OUT_PWD/../peg-highlight/libpeg-highlight.a
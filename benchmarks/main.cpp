@@ -0,0 +1,25 @@
+#include <QApplication>
+#include <QtTest>
+#include <QFile>
+#include "vconfigmanager.h"
+#include "vhighlighterbenchmark.h"
+
+VConfigManager vconfig;
+
+#if defined(QT_NO_DEBUG)
+QFile g_logFile;
+#endif
+
+int main(int argc, char *argv[])
+{
+    // Run without a display, such as on a build farm.
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+    vconfig.initialize();
+
+    VHighlighterBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
@@ -0,0 +1,306 @@
+#include "vbenchmarkcorpus.h"
+
+static const char *c_kindNames[] = {
+    "small",
+    "medium",
+    "huge",
+    "code",
+    "table",
+    "cjk",
+    "emoji",
+    "comments"
+};
+
+static const char *c_pathologyNames[] = {
+    "brackets",
+    "images",
+    "labels",
+    "emph-star",
+    "emph-ul",
+    "strong",
+    "strike",
+    "mixed"
+};
+
+static const char *c_pathologyPatterns[] = {
+    "[",
+    "![",
+    "[a ",
+    "*a ",
+    "_a ",
+    "**a ",
+    "~~a ",
+    "[*"
+};
+
+static const char c_fuzzChars[] = "[]()!*_~`<>#-a \\\n";
+
+// Sizes in characters of the prose notes.
+static const int c_smallSize = 2 * 1024;
+static const int c_mediumSize = 64 * 1024;
+static const int c_hugeSize = 1024 * 1024;
+
+// Size of the notes of other kinds.
+static const int c_mixedSize = 256 * 1024;
+
+static const int c_numOfCommentRegions = 5000;
+
+static const char *c_words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua", "enim", "ad", "minim", "veniam"
+};
+
+static const int c_numOfWords = sizeof(c_words) / sizeof(c_words[0]);
+
+static const char *c_cjkWords[] = {
+    "笔记", "编辑器", "预览", "高亮", "代码块", "目录", "图片", "表格",
+    "ノート", "エディタ", "プレビュー", "強調"
+};
+
+static const int c_numOfCjkWords = sizeof(c_cjkWords) / sizeof(c_cjkWords[0]);
+
+// Code points outside the BMP.
+static const uint c_emojis[] = {
+    0x1F600, 0x1F680, 0x1F389, 0x1F4DD, 0x1F525, 0x1F44D, 0x1F914, 0x2728
+};
+
+static const int c_numOfEmojis = sizeof(c_emojis) / sizeof(c_emojis[0]);
+
+static QString word(int p_seed)
+{
+    return QString::fromLatin1(c_words[p_seed % c_numOfWords]);
+}
+
+// One paragraph of about ten words whose markup depends on @p_seed.
+static QString paragraph(int p_seed)
+{
+    QStringList words;
+    for (int i = 0; i < 10; ++i) {
+        words << word(p_seed * 7 + i * 3);
+    }
+
+    switch (p_seed % 5) {
+    case 0:
+        words[2] = "**" + words[2] + "**";
+        words[6] = "*" + words[6] + "*";
+        break;
+
+    case 1:
+        words[3] = QString("[%1](https://example.com/%2)").arg(words[3]).arg(p_seed);
+        break;
+
+    case 2:
+        words[1] = "`" + words[1] + "`";
+        words[8] = "~~" + words[8] + "~~";
+        break;
+
+    case 3:
+        words[5] = QString("![%1](images/%2.png)").arg(words[5]).arg(p_seed);
+        break;
+
+    default:
+        break;
+    }
+
+    return words.join(' ');
+}
+
+QString VBenchmarkCorpus::name(Kind p_kind)
+{
+    return QString::fromLatin1(c_kindNames[p_kind]);
+}
+
+QString VBenchmarkCorpus::name(Pathology p_pathology)
+{
+    return QString::fromLatin1(c_pathologyNames[p_pathology]);
+}
+
+QString VBenchmarkCorpus::pathological(Pathology p_pathology, int p_repeat)
+{
+    Q_ASSERT(p_pathology < NumOfPathologies);
+    return QString::fromLatin1(c_pathologyPatterns[p_pathology]).repeated(p_repeat) + "\n";
+}
+
+QString VBenchmarkCorpus::fuzz(int p_seed, int p_size)
+{
+    const int nrChars = sizeof(c_fuzzChars) - 1;
+    QString text;
+    text.reserve(p_size + 1);
+    // A linear congruential generator to be the same on every platform.
+    quint32 state = p_seed;
+    for (int i = 0; i < p_size; ++i) {
+        state = state * 1103515245 + 12345;
+        text += QLatin1Char(c_fuzzChars[(state >> 16) % nrChars]);
+    }
+
+    text += '\n';
+    return text;
+}
+
+void VBenchmarkCorpus::appendProse(QString &p_note, int p_size)
+{
+    int seed = 0;
+    while (p_note.size() < p_size) {
+        switch (seed % 8) {
+        case 0:
+            p_note += QString("%1 %2 %3\n\n").arg(QString(seed % 3 + 1, '#'))
+                                              .arg(word(seed))
+                                              .arg(seed);
+            break;
+
+        case 3:
+            for (int i = 0; i < 3; ++i) {
+                p_note += QString("* %1\n").arg(paragraph(seed + i));
+            }
+
+            p_note += '\n';
+            break;
+
+        case 6:
+            p_note += QString("> %1\n\n").arg(paragraph(seed));
+            break;
+
+        default:
+            p_note += paragraph(seed) + "\n" + paragraph(seed + 1) + "\n\n";
+            break;
+        }
+
+        ++seed;
+    }
+}
+
+void VBenchmarkCorpus::appendCodeBlock(QString &p_note, int p_seed, int p_nrLines)
+{
+    p_note += "```cpp\n";
+    for (int i = 0; i < p_nrLines; ++i) {
+        int n = p_seed * p_nrLines + i;
+        p_note += QString("    int value%1 = compute(%1); // step %1\n").arg(n);
+    }
+
+    p_note += "```\n\n";
+}
+
+void VBenchmarkCorpus::appendTable(QString &p_note, int p_seed, int p_nrRows)
+{
+    p_note += "| Name | Value | Note |\n| --- | ---: | :---: |\n";
+    for (int i = 0; i < p_nrRows; ++i) {
+        int n = p_seed * p_nrRows + i;
+        p_note += QString("| %1 | %2 | **%3** `%4` |\n").arg(word(n))
+                                                       .arg(n)
+                                                       .arg(word(n + 1))
+                                                       .arg(word(n + 2));
+    }
+
+    p_note += '\n';
+}
+
+QString VBenchmarkCorpus::note(Kind p_kind)
+{
+    QString text;
+    switch (p_kind) {
+    case Small:
+        appendProse(text, c_smallSize);
+        break;
+
+    case Medium:
+        appendProse(text, c_mediumSize);
+        break;
+
+    case Huge:
+        appendProse(text, c_hugeSize);
+        break;
+
+    case CodeHeavy:
+        for (int i = 0; text.size() < c_mixedSize; ++i) {
+            text += paragraph(i) + "\n\n";
+            appendCodeBlock(text, i, 20);
+        }
+
+        break;
+
+    case TableHeavy:
+        for (int i = 0; text.size() < c_mixedSize; ++i) {
+            text += paragraph(i) + "\n\n";
+            appendTable(text, i, 15);
+        }
+
+        break;
+
+    case CJK:
+        for (int i = 0; text.size() < c_mixedSize; ++i) {
+            if (i % 10 == 0) {
+                text += QString("## %1\n\n").arg(QString::fromUtf8(c_cjkWords[i % c_numOfCjkWords]));
+            }
+
+            for (int j = 0; j < 20; ++j) {
+                QString w = QString::fromUtf8(c_cjkWords[(i * 5 + j) % c_numOfCjkWords]);
+                text += (j == 7) ? "**" + w + "**" : w;
+            }
+
+            text += QString::fromUtf8("。\n\n");
+        }
+
+        break;
+
+    case Emoji:
+        for (int i = 0; text.size() < c_mixedSize; ++i) {
+            QString para = paragraph(i);
+            uint ucs4 = c_emojis[i % c_numOfEmojis];
+            QString emoji = QString::fromUcs4(&ucs4, 1);
+            para.replace(' ', ' ' + emoji);
+            text += para + "\n\n";
+        }
+
+        break;
+
+    case Comments:
+        for (int i = 0; i < c_numOfCommentRegions; ++i) {
+            text += paragraph(i) + "\n\n";
+            text += QString("<!-- %1\n%2 -->\n\n").arg(word(i)).arg(paragraph(i + 1));
+        }
+
+        break;
+
+    default:
+        Q_ASSERT(false);
+        break;
+    }
+
+    return text;
+}
+
+void VBenchmarkCorpus::codeBlocks(int p_nr, QList<VCodeBlock> &p_blocks, QStringList &p_html)
+{
+    const int nrLines = 20;
+    int pos = 0;
+    int blockNum = 0;
+    for (int i = 0; i < p_nr; ++i) {
+        QString text;
+        appendCodeBlock(text, i, nrLines);
+        // Without the trailing blank line.
+        text.chop(2);
+
+        QString html("<pre><code class=\"cpp\">");
+        for (int j = 0; j < nrLines; ++j) {
+            int n = i * nrLines + j;
+            html += QString("    <span class=\"hljs-keyword\">int</span> value%1 = compute("
+                            "<span class=\"hljs-number\">%1</span>); "
+                            "<span class=\"hljs-comment\">// step %1</span>\n").arg(n);
+        }
+
+        html += "</code></pre>";
+
+        VCodeBlock block;
+        block.m_startPos = pos;
+        block.m_startBlock = blockNum;
+        block.m_endBlock = blockNum + nrLines + 1;
+        block.m_lang = "cpp";
+        block.m_text = text;
+        p_blocks.append(block);
+        p_html.append(html);
+
+        pos += text.size() + 2;
+        blockNum += nrLines + 3;
+    }
+}
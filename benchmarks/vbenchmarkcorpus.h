@@ -0,0 +1,86 @@
+#ifndef VBENCHMARKCORPUS_H
+#define VBENCHMARKCORPUS_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include "hgmarkdownhighlighter.h"
+
+// Deterministic Markdown notes of different shapes for the benchmarks.
+class VBenchmarkCorpus
+{
+public:
+    enum Kind
+    {
+        // Prose with headers, lists, emphasis and links.
+        Small = 0,
+        Medium,
+        Huge,
+
+        // Mostly fenced code blocks.
+        CodeHeavy,
+
+        // Mostly tables.
+        TableHeavy,
+
+        // Prose in Chinese and Japanese.
+        CJK,
+
+        // Prose with emoji outside the BMP.
+        Emoji,
+
+        // Thousands of HTML comment regions.
+        Comments,
+
+        NumOfKinds
+    };
+
+    // Inputs on which the parser backtracks heavily.
+    enum Pathology
+    {
+        // Brackets, image brackets and link labels never closed.
+        UnclosedBrackets = 0,
+        UnclosedImages,
+        UnclosedLabels,
+
+        // Emphasis, strong and strike-through markers never closed.
+        UnclosedEmphStar,
+        UnclosedEmphUl,
+        UnclosedStrong,
+        UnclosedStrike,
+
+        // Unclosed brackets and emphasis markers interleaved.
+        MixedMarkers,
+
+        NumOfPathologies
+    };
+
+    // Name of @p_kind to be used as the row of the benchmark data.
+    static QString name(Kind p_kind);
+
+    static QString name(Pathology p_pathology);
+
+    // One paragraph repeating the pattern of @p_pathology @p_repeat times.
+    static QString pathological(Pathology p_pathology, int p_repeat);
+
+    // A paragraph of @p_size characters picked from the Markdown markers by
+    // @p_seed.
+    static QString fuzz(int p_seed, int p_size);
+
+    static QString note(Kind p_kind);
+
+    // Generate @p_nr fenced code blocks in C++ positioned one after another
+    // from position 0. @p_html will contain the highlight.js output of each
+    // one.
+    static void codeBlocks(int p_nr, QList<VCodeBlock> &p_blocks, QStringList &p_html);
+
+private:
+    // Append prose paragraphs to @p_note until it has @p_size characters.
+    static void appendProse(QString &p_note, int p_size);
+
+    static void appendCodeBlock(QString &p_note, int p_seed, int p_nrLines);
+
+    static void appendTable(QString &p_note, int p_seed, int p_nrRows);
+};
+
+#endif // VBENCHMARKCORPUS_H
@@ -0,0 +1,113 @@
+#include "vbenchmarkmemory.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+static std::atomic<qint64> s_numOfAllocations(0);
+
+static std::atomic<qint64> s_bytesAllocated(0);
+
+static void *countedAlloc(std::size_t p_size)
+{
+    ++s_numOfAllocations;
+    s_bytesAllocated += p_size;
+
+    void *ptr = std::malloc(p_size ? p_size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void *operator new(std::size_t p_size)
+{
+    return countedAlloc(p_size);
+}
+
+void *operator new[](std::size_t p_size)
+{
+    return countedAlloc(p_size);
+}
+
+void *operator new(std::size_t p_size, const std::nothrow_t &) noexcept
+{
+    try {
+        return countedAlloc(p_size);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void *operator new[](std::size_t p_size, const std::nothrow_t &) noexcept
+{
+    try {
+        return countedAlloc(p_size);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void operator delete(void *p_ptr) noexcept
+{
+    std::free(p_ptr);
+}
+
+void operator delete[](void *p_ptr) noexcept
+{
+    std::free(p_ptr);
+}
+
+void operator delete(void *p_ptr, const std::nothrow_t &) noexcept
+{
+    std::free(p_ptr);
+}
+
+void operator delete[](void *p_ptr, const std::nothrow_t &) noexcept
+{
+    std::free(p_ptr);
+}
+
+qint64 VBenchmarkMemory::getNumOfAllocations()
+{
+    return s_numOfAllocations.load();
+}
+
+qint64 VBenchmarkMemory::getBytesAllocated()
+{
+    return s_bytesAllocated.load();
+}
+
+qint64 VBenchmarkMemory::getPeakRss()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize / 1024;
+    }
+
+    return -1;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+
+#if defined(Q_OS_MAC)
+    // In bytes on macOS.
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,22 @@
+#ifndef VBENCHMARKMEMORY_H
+#define VBENCHMARKMEMORY_H
+
+#include <QtGlobal>
+
+// Memory counters of the benchmark process. Allocations are counted by the
+// replaced global operator new, so allocations by malloc() in C code such as
+// peg-highlight are not included.
+class VBenchmarkMemory
+{
+public:
+    // Number of allocations since the start of the process.
+    static qint64 getNumOfAllocations();
+
+    // Bytes allocated since the start of the process.
+    static qint64 getBytesAllocated();
+
+    // Peak resident set size of the process in KB. -1 if unknown.
+    static qint64 getPeakRss();
+};
+
+#endif // VBENCHMARKMEMORY_H
@@ -0,0 +1,344 @@
+#include "vhighlighterbenchmark.h"
+
+#include <QtTest>
+#include <QTextDocument>
+#include <QTextBlock>
+#include <QEventLoop>
+#include "vbenchmarkcorpus.h"
+#include "vbenchmarkmemory.h"
+#include "hgmarkdownhighlighter.h"
+#include "vpegparser.h"
+#include "vstyleparser.h"
+#include "vcodeblocktokenizer.h"
+#include "vcodeblockhighlighthelper.h"
+#include "vconfigmanager.h"
+#include "utils/vutils.h"
+
+extern VConfigManager vconfig;
+
+// Max time in ms to wait for the highlighter.
+static const int c_timeout = 60000;
+
+static const int c_numOfCodeBlocks = 200;
+
+static const int c_numOfCommentRegions = 5000;
+
+// Repeats of the patterns of the pathological inputs.
+static const int c_pathologicalRepeats[] = { 1024, 4096, 16384 };
+
+// Without pmh_EXT_PACKRAT, some pathological inputs take exponential time.
+static const int c_regressionRepeat = 5;
+
+static const int c_numOfFuzzInputs = 500;
+
+static const int c_fuzzSize = 32;
+
+// Time budget in ms of a parse without pmh_EXT_PACKRAT in the regression.
+static const unsigned long c_regressionBudget = 200;
+
+// Run @p_func once and log its allocations and the peak RSS so far.
+template <typename F>
+static void reportMemory(F p_func)
+{
+    qint64 allocs = VBenchmarkMemory::getNumOfAllocations();
+    qint64 bytes = VBenchmarkMemory::getBytesAllocated();
+    p_func();
+    allocs = VBenchmarkMemory::getNumOfAllocations() - allocs;
+    bytes = VBenchmarkMemory::getBytesAllocated() - bytes;
+    qDebug() << "allocations:" << allocs << "bytes allocated:" << bytes
+             << "peak RSS KB:" << VBenchmarkMemory::getPeakRss();
+}
+
+void VHighlighterBenchmark::initTestCase()
+{
+    QVERIFY(!vconfig.getMdHighlightingStyles().isEmpty());
+}
+
+void VHighlighterBenchmark::addCorpusRows()
+{
+    QTest::addColumn<QString>("text");
+    for (int i = 0; i < VBenchmarkCorpus::NumOfKinds; ++i) {
+        VBenchmarkCorpus::Kind kind = (VBenchmarkCorpus::Kind)i;
+        QTest::newRow(qPrintable(VBenchmarkCorpus::name(kind))) << VBenchmarkCorpus::note(kind);
+    }
+}
+
+HGMarkdownHighlighter *VHighlighterBenchmark::highlightDocument(QTextDocument *p_doc)
+{
+    HGMarkdownHighlighter *highlighter = new HGMarkdownHighlighter(vconfig.getMdHighlightingStyles(),
+                                                                   vconfig.getCodeBlockFormats(),
+                                                                   p_doc);
+
+    // Highlight the code blocks in process instead of in the web view.
+    connect(highlighter, &HGMarkdownHighlighter::codeBlocksUpdated,
+            highlighter, [highlighter](const QList<VCodeBlock> &p_codeBlocks) {
+                const QHash<QString, quint16> &styleIds = vconfig.getCodeBlockStyleIds();
+                for (auto const & block : p_codeBlocks) {
+                    highlighter->setCodeBlockHighlights(block,
+                                                        VCodeBlockTokenizer::tokenize(block, styleIds),
+                                                        true);
+                }
+            });
+
+    QSignalSpy spy(highlighter, &HGMarkdownHighlighter::highlightCompleted);
+    highlighter->updateHighlight();
+    if (!spy.wait(c_timeout)) {
+        qWarning() << "highlighter does not complete in" << c_timeout << "ms";
+    }
+
+    return highlighter;
+}
+
+void VHighlighterBenchmark::pmhParse_data()
+{
+    addCorpusRows();
+}
+
+void VHighlighterBenchmark::pmhParse()
+{
+    QFETCH(QString, text);
+    QByteArray utf8 = text.toUtf8();
+
+    auto parse = [&utf8]() {
+        pmh_element **result = NULL;
+        pmh_markdown_to_elements(utf8.data(), pmh_EXT_NONE, &result);
+        pmh_free_elements(result);
+    };
+
+    reportMemory(parse);
+    QBENCHMARK {
+        parse();
+    }
+}
+
+void VHighlighterBenchmark::pmhPathological_data()
+{
+    QTest::addColumn<QString>("text");
+    for (int i = 0; i < VBenchmarkCorpus::NumOfPathologies; ++i) {
+        VBenchmarkCorpus::Pathology pathology = (VBenchmarkCorpus::Pathology)i;
+        for (int repeat : c_pathologicalRepeats) {
+            QString name = QString("%1-%2").arg(VBenchmarkCorpus::name(pathology)).arg(repeat);
+            QTest::newRow(qPrintable(name)) << VBenchmarkCorpus::pathological(pathology, repeat);
+        }
+    }
+}
+
+void VHighlighterBenchmark::pmhPathological()
+{
+    QFETCH(QString, text);
+    QByteArray utf8 = text.toUtf8();
+
+    auto parse = [&utf8]() {
+        pmh_element **result = NULL;
+        pmh_markdown_to_elements(utf8.data(), pmh_EXT_PACKRAT, &result);
+        pmh_free_elements(result);
+    };
+
+    reportMemory(parse);
+    QBENCHMARK {
+        parse();
+    }
+}
+
+// Whether @p_a and @p_b have the same elements in the same order.
+static bool sameElements(pmh_element **p_a, pmh_element **p_b)
+{
+    for (int i = 0; i < pmh_NUM_LANG_TYPES; ++i) {
+        pmh_element *a = p_a[i];
+        pmh_element *b = p_b[i];
+        for (; a && b; a = a->next, b = b->next) {
+            if (a->type != b->type || a->pos != b->pos || a->end != b->end) {
+                return false;
+            }
+        }
+
+        if (a || b) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void VHighlighterBenchmark::pmhPackratRegression()
+{
+    QStringList inputs;
+    for (int i = 0; i < VBenchmarkCorpus::NumOfPathologies; ++i) {
+        inputs << VBenchmarkCorpus::pathological((VBenchmarkCorpus::Pathology)i,
+                                                 c_regressionRepeat);
+    }
+
+    for (int i = 0; i < c_numOfFuzzInputs; ++i) {
+        inputs << VBenchmarkCorpus::fuzz(i, c_fuzzSize);
+    }
+
+    int nrCompared = 0;
+    for (auto const & input : inputs) {
+        QByteArray utf8 = input.toUtf8();
+        pmh_element **expected = NULL;
+        int status = pmh_markdown_to_elements_abortable(utf8.data(), pmh_EXT_NONE, &expected,
+                                                        NULL, NULL, NULL,
+                                                        c_regressionBudget);
+        if (status != pmh_PARSE_OK) {
+            // Too slow to be the reference.
+            continue;
+        }
+
+        pmh_element **result = NULL;
+        pmh_markdown_to_elements(utf8.data(), pmh_EXT_PACKRAT, &result);
+        bool same = sameElements(expected, result);
+        pmh_free_elements(expected);
+        pmh_free_elements(result);
+        QVERIFY2(same, utf8.constData());
+        ++nrCompared;
+    }
+
+    qDebug() << nrCompared << "of" << inputs.size() << "inputs compared";
+    QVERIFY(nrCompared > c_numOfFuzzInputs / 2);
+}
+
+void VHighlighterBenchmark::pegParse_data()
+{
+    addCorpusRows();
+}
+
+void VHighlighterBenchmark::pegParse()
+{
+    QFETCH(QString, text);
+
+    QTextDocument doc;
+    doc.setPlainText(text);
+
+    VPegParseConfig config;
+    config.m_text = text;
+    config.m_length = text.size();
+    for (QTextBlock block = doc.begin(); block.isValid(); block = block.next()) {
+        config.m_blockPositions.append(block.position());
+    }
+
+    VPegParser parser(vconfig.getMdHighlightingStyles());
+    QEventLoop loop;
+    connect(&parser, &VPegParser::parseResultReady,
+            &loop, &QEventLoop::quit);
+
+    auto parse = [&parser, &config, &loop]() {
+        parser.parseAsync(config);
+        loop.exec();
+    };
+
+    reportMemory(parse);
+    QBENCHMARK {
+        parse();
+    }
+}
+
+void VHighlighterBenchmark::apply_data()
+{
+    addCorpusRows();
+}
+
+void VHighlighterBenchmark::apply()
+{
+    QFETCH(QString, text);
+
+    QTextDocument doc;
+    doc.setPlainText(text);
+    HGMarkdownHighlighter *highlighter = highlightDocument(&doc);
+
+    auto rehighlight = [highlighter]() {
+        highlighter->rehighlight();
+    };
+
+    reportMemory(rehighlight);
+    QBENCHMARK {
+        rehighlight();
+    }
+
+    qDebug() << "highlights take" << highlighter->getHighlightMemoryUsage() << "bytes";
+}
+
+void VHighlighterBenchmark::styleParse_data()
+{
+    QTest::addColumn<QString>("style");
+    QTest::newRow("default") << VUtils::readFileFromDisk(":/resources/styles/default.mdhl");
+    QTest::newRow("solarized-dark") << VUtils::readFileFromDisk(":/resources/styles/solarized-dark.mdhl");
+    QTest::newRow("solarized-light") << VUtils::readFileFromDisk(":/resources/styles/solarized-light.mdhl");
+}
+
+void VHighlighterBenchmark::styleParse()
+{
+    QFETCH(QString, style);
+    QVERIFY(!style.isEmpty());
+
+    QFont font = vconfig.getMdEditFont();
+    auto parse = [&style, &font]() {
+        VStyleParser parser;
+        parser.parseMarkdownStyle(style);
+        parser.fetchMarkdownStyles(font);
+        parser.fetchCodeBlockStyles(font);
+    };
+
+    reportMemory(parse);
+    QBENCHMARK {
+        parse();
+    }
+}
+
+void VHighlighterBenchmark::parseHighlightHtml()
+{
+    QList<VCodeBlock> blocks;
+    QStringList html;
+    VBenchmarkCorpus::codeBlocks(c_numOfCodeBlocks, blocks, html);
+
+    const QHash<QString, quint16> &styleIds = vconfig.getCodeBlockStyleIds();
+    int nrUnits = 0;
+    auto parse = [&blocks, &html, &styleIds, &nrUnits]() {
+        nrUnits = 0;
+        for (int i = 0; i < blocks.size(); ++i) {
+            QList<HLUnitPos> units;
+            if (VCodeBlockHighlightHelper::parseHighlightHtml(blocks[i], html[i], styleIds, units)) {
+                nrUnits += units.size();
+            }
+        }
+    };
+
+    reportMemory(parse);
+    QVERIFY(nrUnits > 0);
+    QBENCHMARK {
+        parse();
+    }
+}
+
+void VHighlighterBenchmark::commentRegionLookup()
+{
+    // Regions of two blocks, each after two normal blocks.
+    const int blockLength = 40;
+    QVector<VCommentRegion> regions;
+    for (int i = 0; i < c_numOfCommentRegions; ++i) {
+        int start = (i * 4 + 2) * blockLength;
+        regions.append(VCommentRegion(start, start + 2 * blockLength - 1));
+    }
+
+    VCommentRegion::sortAndMerge(regions);
+
+    int nrBlocks = c_numOfCommentRegions * 4;
+    int nrInside = 0;
+    auto lookup = [&regions, nrBlocks, &nrInside]() {
+        nrInside = 0;
+        for (int i = 0; i < nrBlocks; ++i) {
+            int start = i * blockLength;
+            int idx = VCommentRegion::lowerBound(regions, start);
+            if (idx < regions.size()
+                && regions[idx].contains(start)
+                && regions[idx].contains(start + blockLength - 1)) {
+                ++nrInside;
+            }
+        }
+    };
+
+    reportMemory(lookup);
+    QCOMPARE(nrInside, c_numOfCommentRegions * 2);
+    QBENCHMARK {
+        lookup();
+    }
+}
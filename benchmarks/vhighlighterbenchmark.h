@@ -0,0 +1,61 @@
+#ifndef VHIGHLIGHTERBENCHMARK_H
+#define VHIGHLIGHTERBENCHMARK_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+class QTextDocument;
+class HGMarkdownHighlighter;
+
+// Benchmarks of the highlighting pipeline of the editor in an offscreen
+// QTextDocument. Besides the time of each benchmark, the allocations of one
+// run and the peak RSS are logged.
+class VHighlighterBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    // pmh_markdown_to_elements() on the UTF-8 text.
+    void pmhParse_data();
+    void pmhParse();
+
+    // pmh_markdown_to_elements() with pmh_EXT_PACKRAT on inputs that make
+    // the parser backtrack, at growing sizes. The time should grow linearly.
+    void pmhPathological_data();
+    void pmhPathological();
+
+    // pmh_EXT_PACKRAT should not change the elements of the pathological
+    // and fuzzed inputs.
+    void pmhPackratRegression();
+
+    // Parse a snapshot by VPegParser, from transcoding to bucketing units
+    // by block.
+    void pegParse_data();
+    void pegParse();
+
+    // Rehighlight all the blocks with the parsed highlights.
+    void apply_data();
+    void apply();
+
+    // Parse the editor styles and fetch the formats.
+    void styleParse_data();
+    void styleParse();
+
+    // Convert the highlight.js output of code blocks into highlight units.
+    void parseHighlightHtml();
+
+    // Look up the HTML comment region of each block.
+    void commentRegionLookup();
+
+private:
+    // Add a row of each corpus kind.
+    void addCorpusRows();
+
+    // Create a highlighter on @p_doc and wait until it has highlighted it.
+    HGMarkdownHighlighter *highlightDocument(QTextDocument *p_doc);
+};
+
+#endif // VHIGHLIGHTERBENCHMARK_H
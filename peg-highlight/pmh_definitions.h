@@ -118,8 +118,13 @@ enum pmh_extensions
     pmh_EXT_NONE    = 0,        /**< No extensions */
     pmh_EXT_NOTES   = (1 << 0), /**< Footnote syntax:
                                      http://pandoc.org/README.html#footnotes */
-    pmh_EXT_STRIKE  = (1 << 1)  /**< Strike-through syntax:
+    pmh_EXT_STRIKE  = (1 << 1), /**< Strike-through syntax:
                                      http://pandoc.org/README.html#strikeout */
+    pmh_EXT_PACKRAT = (1 << 2)  /**< Not a syntax: memoize the failures of
+                                     the rules that backtrack heavily, so
+                                     that long runs of unclosed brackets or
+                                     emphasis markers parse in linear time,
+                                     at the cost of up to 16 MB of memory */
 };
 
 #endif
@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 struct _GREG;
 #define YYRULECOUNT 225
@@ -28,6 +29,13 @@ struct _GREG;
 
 #include "pmh_parser.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 #ifndef pmh_DEBUG_OUTPUT
 #define pmh_DEBUG_OUTPUT 0
 #endif
@@ -56,6 +64,200 @@ char *strdup_or_null(char *s)
 }
 
 
+// Size of the slabs of an arena, and the alignment of the blocks
+// allocated from it:
+#define pmh_ARENA_SLAB_SIZE     (64 * 1024)
+#define pmh_ARENA_ALIGN         8
+
+// A slab of memory of an arena. The usable memory follows the header:
+typedef struct pmh_ArenaSlab
+{
+    struct pmh_ArenaSlab *next;
+    size_t size;
+    size_t used;
+} pmh_arena_slab;
+
+#define SLAB_HEADER_SIZE \
+    ((sizeof(pmh_arena_slab) + pmh_ARENA_ALIGN - 1) & ~(size_t)(pmh_ARENA_ALIGN - 1))
+
+// Bump allocator for all the memory needed by one parse, which is released
+// in one shot. Slabs are kept when the arena is reset so that it may be
+// reused by the next parse without allocating from the heap:
+struct pmh_Arena
+{
+    /* All slabs, in the order they were allocated: */
+    pmh_arena_slab *slabs;
+    
+    /* The slab we are allocating from: */
+    pmh_arena_slab *current;
+    
+    /* Whether the arena was created for one parse only and should be */
+    /* freed together with the results: */
+    bool transient;
+    
+    /* Parser scratch buffers, kept across parses: */
+    struct _GREG *greg;
+};
+
+pmh_arena *pmh_arena_new()
+{
+    pmh_arena *arena = (pmh_arena *)malloc(sizeof(pmh_arena));
+    arena->slabs = NULL;
+    arena->current = NULL;
+    arena->transient = false;
+    arena->greg = NULL;
+    return arena;
+}
+
+static pmh_arena_slab *arena_new_slab(size_t min_size)
+{
+    size_t size = (min_size > pmh_ARENA_SLAB_SIZE) ? min_size : pmh_ARENA_SLAB_SIZE;
+    pmh_arena_slab *slab = (pmh_arena_slab *)malloc(SLAB_HEADER_SIZE + size);
+    slab->next = NULL;
+    slab->size = size;
+    slab->used = 0;
+    return slab;
+}
+
+static void *arena_alloc(pmh_arena *arena, size_t size)
+{
+    size = (size + pmh_ARENA_ALIGN - 1) & ~(size_t)(pmh_ARENA_ALIGN - 1);
+    
+    pmh_arena_slab *slab = arena->current;
+    while (slab != NULL && slab->size - slab->used < size)
+    {
+        // Move on to the next slab kept from previous parses:
+        if (slab->next == NULL)
+            break;
+        slab = slab->next;
+        arena->current = slab;
+    }
+    
+    if (slab == NULL || slab->size - slab->used < size)
+    {
+        pmh_arena_slab *new_slab = arena_new_slab(size);
+        if (slab == NULL)
+            arena->slabs = new_slab;
+        else
+            slab->next = new_slab;
+        arena->current = slab = new_slab;
+    }
+    
+    void *ret = (char *)slab + SLAB_HEADER_SIZE + slab->used;
+    slab->used += size;
+    return ret;
+}
+
+static char *arena_strndup(pmh_arena *arena, const char *s, size_t len)
+{
+    char *ret = (char *)arena_alloc(arena, len + 1);
+    memcpy(ret, s, len);
+    ret[len] = '\0';
+    return ret;
+}
+
+static char *arena_strdup_or_null(pmh_arena *arena, const char *s)
+{
+    return (s == NULL) ? NULL : arena_strndup(arena, s, strlen(s));
+}
+
+void pmh_arena_reset(pmh_arena *arena)
+{
+    pmh_arena_slab *slab = arena->slabs;
+    for (; slab != NULL; slab = slab->next)
+        slab->used = 0;
+    arena->current = arena->slabs;
+}
+
+
+// Milliseconds from an arbitrary fixed point in time:
+static unsigned long long pmh_now_ms()
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+
+// State for abandoning a parse, shared by all the parsing runs of one
+// pmh_markdown_to_elements() call:
+typedef struct
+{
+    /* Abandon the parse once cancel_callback returns non-zero (may be NULL): */
+    pmh_cancel_callback cancel_callback;
+    void *cancel_context;
+    
+    /* Abandon the parse after this point in time (0 for no limit): */
+    unsigned long long deadline;
+    
+    /* Number of checks, to look at the clock only every now and then: */
+    unsigned int nr_checks;
+    
+    /* A pmh_parse_status value: */
+    int status;
+} abort_control;
+
+
+// Failures of the memoized rules (see pmh_EXT_PACKRAT), shared by all the
+// parsing runs of one pmh_markdown_to_elements() call and cleared before
+// each run:
+typedef struct
+{
+    /* Bit i of failed[pos] is set if memoized rule i failed at pos: */
+    unsigned short *failed;
+    
+    /* Number of positions in failed. Positions beyond are not memoized: */
+    size_t capacity;
+    
+    /* Bits may only be set below this position in current run: */
+    size_t high_water;
+    
+    /* Stack of the positions where the loops of the memoized rules being */
+    /* parsed have started an iteration (see loop_tail_visit()): */
+    size_t *tail;
+    size_t tail_len;
+    size_t tail_cap;
+} packrat_memo;
+
+// Max size of the memo of one parse. Positions beyond it are parsed without
+// memoization:
+#define PACKRAT_MAX_BYTES (16 * 1024 * 1024)
+
+// Rules whose failures are memoized with pmh_EXT_PACKRAT. They are the
+// ones tried again and again at the same position on backtracking, such as
+// when a bracket or an emphasis marker is never closed. Each one has a bit
+// for itself and one for the tail of its loop, at most 16 bits in all:
+enum packrat_rule
+{
+    PACKRAT_Label,
+    PACKRAT_StrongStar,
+    PACKRAT_StrongUl,
+    PACKRAT_EmphStar,
+    PACKRAT_EmphUl,
+    PACKRAT_Strike,
+    
+    // The loop of the rule from this position reaches no closing marker:
+    PACKRAT_LabelTail,
+    PACKRAT_StrongStarTail,
+    PACKRAT_StrongUlTail,
+    PACKRAT_EmphStarTail,
+    PACKRAT_EmphUlTail,
+    PACKRAT_StrikeTail,
+    
+    PACKRAT_NUM_RULES
+};
+
+typedef char packrat_rules_fit_in_memo[PACKRAT_NUM_RULES <= 16 ? 1 : -1];
+
+static size_t loop_tail_begin(struct _GREG *G);
+static int loop_tail_visit(struct _GREG *G, int tail);
+static void loop_tail_end(struct _GREG *G, size_t base, int failed);
+
+
 // Internal language element occurrence structure, containing
 // both public and private members:
 struct pmh_RealElement
@@ -101,6 +303,13 @@ typedef struct
     unsigned long *strip_positions;
     size_t strip_positions_len;
     
+    /* The original input as UTF-16 if it was given preformatted (in which */
+    /* case original_input is NULL), and the offsets of the code points */
+    /* outside the BMP in charbuf: */
+    const unsigned short *original_utf16;
+    const unsigned long *astral_positions;
+    size_t astral_positions_len;
+    
     /* Buffer of characters to be parsed: */
     char *charbuf;
     
@@ -124,8 +333,25 @@ typedef struct
     
     /* List of reference elements: */
     pmh_realelement *references;
+    
+    /* Cancellation and time budget (may be NULL): */
+    abort_control *abort_ctl;
+    
+    /* Memoized failures (NULL if pmh_EXT_PACKRAT is not set): */
+    packrat_memo *memo;
+    
+    /* Arena for all the allocations of the parse: */
+    pmh_arena *arena;
 } parser_data;
 
+// Array of parsing results returned to the caller, remembering the arena
+// the results live in:
+typedef struct
+{
+    pmh_arena *arena;
+    pmh_realelement *head_elems[pmh_NUM_TYPES];
+} parse_result;
+
 static parser_data *mk_parser_data(char *original_input,
                                    unsigned long *strip_positions,
                                    size_t strip_positions_len,
@@ -134,13 +360,21 @@ static parser_data *mk_parser_data(char *original_input,
                                    unsigned long offset,
                                    int extensions,
                                    pmh_realelement **head_elems,
-                                   pmh_realelement *references)
+                                   pmh_realelement *references,
+                                   abort_control *abort_ctl,
+                                   pmh_arena *arena)
 {
-    parser_data *p_data = (parser_data *)malloc(sizeof(parser_data));
+    parser_data *p_data = (parser_data *)arena_alloc(arena, sizeof(parser_data));
+    p_data->abort_ctl = abort_ctl;
+    p_data->memo = NULL;
+    p_data->arena = arena;
     p_data->extensions = extensions;
     p_data->original_input = original_input;
     p_data->strip_positions = strip_positions;
     p_data->strip_positions_len = strip_positions_len;
+    p_data->original_utf16 = NULL;
+    p_data->astral_positions = NULL;
+    p_data->astral_positions_len = 0;
     p_data->charbuf = charbuf;
     p_data->offset = offset;
     p_data->elem_head = p_data->current_elem = parsing_elems;
@@ -149,8 +383,10 @@ static parser_data *mk_parser_data(char *original_input,
     if (head_elems != NULL)
         p_data->head_elems = head_elems;
     else {
-        p_data->head_elems = (pmh_realelement **)
-                             malloc(sizeof(pmh_realelement *) * pmh_NUM_TYPES);
+        parse_result *result = (parse_result *)arena_alloc(arena,
+                                                           sizeof(parse_result));
+        result->arena = arena;
+        p_data->head_elems = result->head_elems;
         int i;
         for (i = 0; i < pmh_NUM_TYPES; i++)
             p_data->head_elems[i] = NULL;
@@ -164,6 +400,30 @@ static void parse_markdown(parser_data *p_data);
 static void parse_references(parser_data *p_data);
 
 
+/*
+Return true if the parse should be abandoned. Called for every character
+matched by the parser, so the flag and the clock are only polled every
+few thousand calls.
+*/
+static bool parse_aborted(parser_data *p_data)
+{
+    abort_control *ctl = p_data->abort_ctl;
+    if (ctl == NULL)
+        return false;
+    if (ctl->status != pmh_PARSE_OK)
+        return true;
+    if ((++ctl->nr_checks & 0xFFF) != 0)
+        return false;
+    
+    if (ctl->cancel_callback != NULL && ctl->cancel_callback(ctl->cancel_context) != 0)
+        ctl->status = pmh_PARSE_CANCELLED;
+    else if (ctl->deadline != 0 && pmh_now_ms() >= ctl->deadline)
+        ctl->status = pmh_PARSE_TIMEOUT;
+    
+    return ctl->status != pmh_PARSE_OK;
+}
+
+
 
 
 
@@ -312,7 +572,8 @@ iteratively until no such elements exist.
 static void process_raw_blocks(parser_data *p_data)
 {
     pmh_PRINTF("--------process_raw_blocks---------\n");
-    while (p_data->head_elems[pmh_RAW_LIST] != NULL)
+    while (p_data->head_elems[pmh_RAW_LIST] != NULL
+           && !parse_aborted(p_data))
     {
         pmh_PRINTF("new iteration.\n");
         pmh_realelement *cursor = p_data->head_elems[pmh_RAW_LIST];
@@ -369,10 +630,15 @@ static void process_raw_blocks(parser_data *p_data)
                     subspan_list->pos,
                     p_data->extensions,
                     p_data->head_elems,
-                    p_data->references
+                    p_data->references,
+                    p_data->abort_ctl,
+                    p_data->arena
                 );
+                raw_p_data->original_utf16 = p_data->original_utf16;
+                raw_p_data->astral_positions = p_data->astral_positions;
+                raw_p_data->astral_positions_len = p_data->astral_positions_len;
+                raw_p_data->memo = p_data->memo;
                 parse_markdown(raw_p_data);
-                free(raw_p_data);
                 
                 pmh_PRINTF("parse over\n");
             }
@@ -403,21 +669,14 @@ static void print_raw_blocks(char *text, pmh_realelement *elem[])
 /* Free all elements created while parsing */
 void pmh_free_elements(pmh_element **elems)
 {
-    pmh_realelement *cursor = (pmh_realelement*)elems[pmh_ALL];
-    while (cursor != NULL) {
-        pmh_realelement *tofree = cursor;
-        cursor = cursor->all_elems_next;
-        if (tofree->text != NULL)
-            free(tofree->text);
-        if (tofree->label != NULL)
-            free(tofree->label);
-        if (tofree->address != NULL)
-            free(tofree->address);
-        free(tofree);
-    }
-    elems[pmh_ALL] = NULL;
-    
-    free(elems);
+    // All the elements live in the arena of the parse:
+    parse_result *result = (parse_result *)((char *)elems
+                                            - offsetof(parse_result, head_elems));
+    pmh_arena *arena = result->arena;
+    if (arena->transient)
+        pmh_arena_free(arena);
+    else
+        pmh_arena_reset(arena);
 }
 
 
@@ -429,21 +688,6 @@ void pmh_free_elements(pmh_element **elems)
 #define HAS_UTF8_BOM(x)         ( ((*x & 0xFF) == 0xEF)\
                                   && ((*(x+1) & 0xFF) == 0xBB)\
                                   && ((*(x+2) & 0xFF) == 0xBF) )
-#define ADD_STRIP_POS(x) \
-    /* reallocate more space for the array, if needed: */ \
-    if (strip_positions_size <= strip_positions_pos) { \
-        size_t new_size = strip_positions_size * 2; \
-        unsigned long *new_arr = (unsigned long *) \
-                                 calloc(new_size, \
-                                        sizeof(unsigned long)); \
-        memcpy(new_arr, strip_positions, \
-               (sizeof(unsigned long) * strip_positions_size)); \
-        strip_positions_size = new_size; \
-        free(strip_positions); \
-        strip_positions = new_arr; \
-    } \
-    strip_positions[strip_positions_pos] = x; \
-    strip_positions_pos++;
 
 /*
 Copy `str` to `out`, while doing the following:
@@ -451,28 +695,41 @@ Copy `str` to `out`, while doing the following:
   - remove possible UTF-8 BOM (byte order mark)
   - append two newlines to the end (like peg-markdown does)
   - keep track of which bytes we have stripped (in strip_positions)
+Both `out` and `out_strip_positions` are allocated from `arena`.
 */
-static int strcpy_preformat(char *str, char **out,
+static int strcpy_preformat(pmh_arena *arena, char *str, char **out,
                             unsigned long **out_strip_positions,
                             size_t *out_strip_positions_len)
 {
-    size_t strip_positions_size = 1024;
-    size_t strip_positions_pos = 0;
-    unsigned long *strip_positions = (unsigned long *)
-                                     calloc(strip_positions_size,
-                                            sizeof(unsigned long));
+    // Count the bytes to strip first to allocate exactly once:
+    size_t len = 0;
+    size_t strip_positions_len = 0;
+    char *c = str;
+    for (; *c != '\0'; c++, len++)
+    {
+        if (IS_CONTINUATION_BYTE(*c))
+            strip_positions_len++;
+    }
+    
+    bool has_bom = len >= 3 && HAS_UTF8_BOM(str);
+    if (has_bom)
+        strip_positions_len += 3;
     
+    unsigned long *strip_positions = (unsigned long *)
+                                     arena_alloc(arena, sizeof(unsigned long)
+                                                        * (strip_positions_len + 1));
+    size_t strip_positions_pos = 0;
     
     // +2 in the following is due to the "\n\n" suffix:
-    char *new_str = (char *)malloc(sizeof(char) * strlen(str) + 1 + 2);
-    char *c = str;
+    char *new_str = (char *)arena_alloc(arena, sizeof(char) * len + 1 + 2);
+    c = str;
     int i = 0;
     
-    if (HAS_UTF8_BOM(c)) {
+    if (has_bom) {
         c += 3;
-        ADD_STRIP_POS(0);
-        ADD_STRIP_POS(1);
-        ADD_STRIP_POS(2);
+        strip_positions[strip_positions_pos++] = 0;
+        strip_positions[strip_positions_pos++] = 1;
+        strip_positions[strip_positions_pos++] = 2;
     }
     
     while (*c != '\0')
@@ -480,7 +737,7 @@ static int strcpy_preformat(char *str, char **out,
         if (!IS_CONTINUATION_BYTE(*c)) {
             *(new_str+i) = *c, i++;
         } else {
-            ADD_STRIP_POS((int)(c-str));
+            strip_positions[strip_positions_pos++] = (unsigned long)(c-str);
         }
         c++;
     }
@@ -497,36 +754,65 @@ static int strcpy_preformat(char *str, char **out,
 
 
 
-void pmh_markdown_to_elements(char *text, int extensions,
-                              pmh_element **out_result[])
+// Prepare the arena for a parse:
+static pmh_arena *prepare_arena(pmh_arena *arena)
+{
+    if (arena == NULL) {
+        arena = pmh_arena_new();
+        arena->transient = true;
+    } else {
+        pmh_arena_reset(arena);
+    }
+    return arena;
+}
+
+static void init_abort_control(abort_control *abort_ctl,
+                               pmh_cancel_callback cancel_callback,
+                               void *cancel_context,
+                               unsigned long time_budget_ms)
+{
+    abort_ctl->cancel_callback = cancel_callback;
+    abort_ctl->cancel_context = cancel_context;
+    abort_ctl->deadline = (time_budget_ms > 0)
+                          ? pmh_now_ms() + time_budget_ms : 0;
+    abort_ctl->nr_checks = 0;
+    abort_ctl->status = pmh_PARSE_OK;
+}
+
+// Parse the whole p_data->charbuf of text_len bytes:
+static int parse_charbuf(parser_data *p_data, unsigned long text_len,
+                         pmh_element **out_result[])
 {
-    char *text_copy = NULL;
-    unsigned long *strip_positions = NULL;
-    size_t strip_positions_len = 0;
-    int text_copy_len = strcpy_preformat(text, &text_copy, &strip_positions,
-                                         &strip_positions_len);
-    
     pmh_realelement *parsing_elem = (pmh_realelement *)
-                                    malloc(sizeof(pmh_realelement));
+                                    arena_alloc(p_data->arena,
+                                                sizeof(pmh_realelement));
     parsing_elem->type = pmh_RAW;
     parsing_elem->pos = 0;
-    parsing_elem->end = text_copy_len;
+    parsing_elem->end = text_len;
     parsing_elem->next = NULL;
+    p_data->elem_head = p_data->current_elem = parsing_elem;
     
-    parser_data *p_data = mk_parser_data(
-        text,
-        strip_positions,
-        strip_positions_len,
-        text_copy,
-        parsing_elem,
-        0,
-        extensions,
-        NULL,
-        NULL
-    );
     pmh_realelement **result = p_data->head_elems;
     
-    if (*text_copy != '\0')
+    // The memo lives for this parse only. No run parses more than the
+    // whole text:
+    packrat_memo memo;
+    memo.failed = NULL;
+    if (p_data->extensions & pmh_EXT_PACKRAT)
+    {
+        memo.capacity = text_len + 1;
+        if (memo.capacity > PACKRAT_MAX_BYTES / sizeof(unsigned short))
+            memo.capacity = PACKRAT_MAX_BYTES / sizeof(unsigned short);
+        memo.failed = (unsigned short *)calloc(memo.capacity,
+                                               sizeof(unsigned short));
+        memo.high_water = 0;
+        memo.tail = NULL;
+        memo.tail_len = memo.tail_cap = 0;
+        if (memo.failed != NULL)
+            p_data->memo = &memo;
+    }
+    
+    if (*p_data->charbuf != '\0')
     {
         // Get reference definitions into p_data->references
         parse_references(p_data);
@@ -536,21 +822,105 @@ void pmh_markdown_to_elements(char *text, int extensions,
         p_data->current_elem = p_data->elem_head;
         
         // Parse whole document
-        parse_markdown(p_data);
+        if (!parse_aborted(p_data))
+            parse_markdown(p_data);
         
         #if pmh_DEBUG_OUTPUT
-        print_raw_blocks(text_copy, result);
+        print_raw_blocks(p_data->charbuf, result);
         #endif
         
         process_raw_blocks(p_data);
     }
     
-    free(strip_positions);
-    free(p_data);
-    free(parsing_elem);
-    free(text_copy);
+    p_data->memo = NULL;
+    if (memo.failed != NULL)
+        free(memo.tail);
+    free(memo.failed);
+    
+    int status = p_data->abort_ctl->status;
+    if (status != pmh_PARSE_OK) {
+        // Partial results are of no use:
+        pmh_free_elements((pmh_element**)result);
+        result = NULL;
+    }
     
     *out_result = (pmh_element**)result;
+    return status;
+}
+
+int pmh_markdown_to_elements_abortable(char *text, int extensions,
+                                       pmh_element **out_result[],
+                                       pmh_arena *arena,
+                                       pmh_cancel_callback cancel_callback,
+                                       void *cancel_context,
+                                       unsigned long time_budget_ms)
+{
+    arena = prepare_arena(arena);
+    
+    abort_control abort_ctl;
+    init_abort_control(&abort_ctl, cancel_callback, cancel_context, time_budget_ms);
+    
+    char *text_copy = NULL;
+    unsigned long *strip_positions = NULL;
+    size_t strip_positions_len = 0;
+    int text_copy_len = strcpy_preformat(arena, text, &text_copy,
+                                         &strip_positions, &strip_positions_len);
+    
+    parser_data *p_data = mk_parser_data(
+        text,
+        strip_positions,
+        strip_positions_len,
+        text_copy,
+        NULL,
+        0,
+        extensions,
+        NULL,
+        NULL,
+        &abort_ctl,
+        arena
+    );
+    
+    return parse_charbuf(p_data, text_copy_len, out_result);
+}
+
+int pmh_preformatted_to_elements(const pmh_preformatted_input *input,
+                                 int extensions,
+                                 pmh_element **out_result[],
+                                 pmh_arena *arena,
+                                 pmh_cancel_callback cancel_callback,
+                                 void *cancel_context,
+                                 unsigned long time_budget_ms)
+{
+    arena = prepare_arena(arena);
+    
+    abort_control abort_ctl;
+    init_abort_control(&abort_ctl, cancel_callback, cancel_context, time_budget_ms);
+    
+    parser_data *p_data = mk_parser_data(
+        NULL,
+        NULL,
+        0,
+        input->charbuf,
+        NULL,
+        0,
+        extensions,
+        NULL,
+        NULL,
+        &abort_ctl,
+        arena
+    );
+    p_data->original_utf16 = input->utf16;
+    p_data->astral_positions = input->astral_positions;
+    p_data->astral_positions_len = input->astral_positions_len;
+    
+    return parse_charbuf(p_data, strlen(input->charbuf), out_result);
+}
+
+void pmh_markdown_to_elements(char *text, int extensions,
+                              pmh_element **out_result[])
+{
+    pmh_markdown_to_elements_abortable(text, extensions, out_result,
+                                       NULL, NULL, NULL, 0);
 }
 
 
@@ -711,7 +1081,8 @@ static pmh_realelement *reverse(pmh_realelement *list)
 static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
                                    long pos, long end)
 {
-    pmh_realelement *result = (pmh_realelement *)malloc(sizeof(pmh_realelement));
+    pmh_realelement *result = (pmh_realelement *)
+                              arena_alloc(p_data->arena, sizeof(pmh_realelement));
     memset(result, 0, sizeof(*result));
     result->type = type;
     result->pos = pos;
@@ -729,9 +1100,9 @@ static pmh_realelement *mk_element(parser_data *p_data, pmh_element_type type,
 static pmh_realelement *copy_element(parser_data *p_data, pmh_realelement *elem)
 {
     pmh_realelement *result = mk_element(p_data, elem->type, elem->pos, elem->end);
-    result->label = strdup_or_null(elem->label);
-    result->text = strdup_or_null(elem->text);
-    result->address = strdup_or_null(elem->address);
+    result->label = arena_strdup_or_null(p_data->arena, elem->label);
+    result->text = arena_strdup_or_null(p_data->arena, elem->text);
+    result->address = arena_strdup_or_null(p_data->arena, elem->address);
     return result;
 }
 
@@ -741,7 +1112,7 @@ static pmh_realelement *mk_etext(parser_data *p_data, char *string)
     pmh_realelement *result;
     assert(string != NULL);
     result = mk_element(p_data, pmh_EXTRA_TEXT, 0,0);
-    result->text = strdup_or_null(string);
+    result->text = arena_strdup_or_null(p_data->arena, string);
     return result;
 }
 
@@ -880,6 +1251,62 @@ static void add(parser_data *p_data, pmh_realelement *elem)
 }
 
 
+// Given an offset in charbuf, return the corresponding offset in
+// p_data->original_utf16, which is larger by the number of code points
+// outside the BMP (taking two UTF-16 units) before it:
+static unsigned long utf16_offset(parser_data *p_data, unsigned long pos)
+{
+    size_t lo = 0;
+    size_t hi = p_data->astral_positions_len;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (p_data->astral_positions[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return pos + lo;
+}
+
+// Encode the UTF-16 units [pos, end) as UTF-8 into `out` (which must have
+// room for 3 bytes per unit), returning the number of bytes written:
+static size_t utf16_to_utf8(const unsigned short *utf16,
+                            unsigned long pos, unsigned long end, char *out)
+{
+    char *c = out;
+    unsigned long i;
+    for (i = pos; i < end; i++)
+    {
+        unsigned long cp = utf16[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < end
+            && utf16[i+1] >= 0xDC00 && utf16[i+1] <= 0xDFFF)
+        {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (utf16[i+1] - 0xDC00);
+            i++;
+        }
+        else if (cp >= 0xD800 && cp <= 0xDFFF)
+            cp = 0xFFFD; // Unpaired surrogate
+        
+        if (cp < 0x80)
+            *c++ = (char)cp;
+        else if (cp < 0x800) {
+            *c++ = (char)(0xC0 | (cp >> 6));
+            *c++ = (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            *c++ = (char)(0xE0 | (cp >> 12));
+            *c++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+            *c++ = (char)(0x80 | (cp & 0x3F));
+        } else {
+            *c++ = (char)(0xF0 | (cp >> 18));
+            *c++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+            *c++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+            *c++ = (char)(0x80 | (cp & 0x3F));
+        }
+    }
+    return c - out;
+}
+
 // Given a range in the list of spans we use for parsing (pos, end), return
 // a copy of the corresponding section in the original input, with all of
 // the UTF-8 bytes intact:
@@ -903,6 +1330,26 @@ static char *copy_input_span(parser_data *p_data,
             continue;
         }
         
+        size_t ret_len = (ret == NULL) ? 0 : strlen(ret);
+        
+        if (p_data->original_utf16 != NULL)
+        {
+            // Encode span from original UTF-16 input (appending it to ret):
+            unsigned long utf16_pos = utf16_offset(p_data, cursor->pos);
+            unsigned long utf16_end = utf16_offset(p_data, cursor->end);
+            char *new_ret = (char *)arena_alloc(p_data->arena,
+                                                sizeof(char)*(ret_len + (utf16_end - utf16_pos) * 3) + 1);
+            if (ret != NULL)
+                memcpy(new_ret, ret, ret_len);
+            ret_len += utf16_to_utf8(p_data->original_utf16, utf16_pos, utf16_end,
+                                     new_ret + ret_len);
+            *(new_ret + ret_len) = '\0';
+            ret = new_ret;
+            
+            cursor = cursor->next;
+            continue;
+        }
+        
         // Adjust cursor's span to take bytes stripped from the original
         // input into account (i.e. match the corresponding span in
         // p_data->original_input):
@@ -920,26 +1367,16 @@ static char *copy_input_span(parser_data *p_data,
                 break;
         }
         
-        // Copy span from original input:
+        // Copy span from original input (appending it to ret):
         size_t adjusted_len = adjusted_end - adjusted_pos;
-        char *str = (char *)malloc(sizeof(char)*adjusted_len + 1);
-        *str = '\0';
-        strncat(str, (p_data->original_input + adjusted_pos), adjusted_len);
-        
-        if (ret == NULL)
-            ret = str;
-        else
-        {
-            // append str to ret:
-            char *new_ret = (char *)malloc(sizeof(char)
-                                           *(strlen(str) + strlen(ret)) + 1);
-            *new_ret = '\0';
-            strcat(new_ret, ret);
-            strcat(new_ret, str);
-            free(ret);
-            free(str);
-            ret = new_ret;
-        }
+        char *new_ret = (char *)arena_alloc(p_data->arena,
+                                            sizeof(char)*(ret_len + adjusted_len) + 1);
+        if (ret != NULL)
+            memcpy(new_ret, ret, ret_len);
+        *(new_ret + ret_len) = '\0';
+        strncat(new_ret + ret_len, (p_data->original_input + adjusted_pos),
+                adjusted_len);
+        ret = new_ret;
         
         cursor = cursor->next;
     }
@@ -962,7 +1399,7 @@ static char *copy_input_span(parser_data *p_data,
 static void yy_input_func(char *buf, int *result, int max_size,
                           parser_data *p_data)
 {
-    if (p_data->current_elem == NULL)
+    if (p_data->current_elem == NULL || parse_aborted(p_data))
     {
         (*result) = 0;
         return;
@@ -1017,11 +1454,14 @@ static void yy_input_func(char *buf, int *result, int max_size,
 #define etext(x)    mk_etext((parser_data *)G->data, x)
 #define ADD(x)      add((parser_data *)G->data, x)
 #define EXT(x)      extension((parser_data *)G->data, x)
+#define ABORTED()   parse_aborted((parser_data *)G->data)
 #define REF_EXISTS(x) reference_exists((parser_data *)G->data, x)
 #define GET_REF(x)  get_reference((parser_data *)G->data, x)
 #define PARSING_REFERENCES ((parser_data *)G->data)->parsing_only_references
-#define FREE_LABEL(l) { free(l->label); l->label = NULL; }
-#define FREE_ADDRESS(l) { free(l->address); l->address = NULL; }
+#define COPY_STR(x)   arena_strdup_or_null(((parser_data *)G->data)->arena, x)
+// Strings live in the arena of the parse and are released along with it:
+#define FREE_LABEL(l) { l->label = NULL; }
+#define FREE_ADDRESS(l) { l->address = NULL; }
 
 // This gives us the text matched with < > as it appears in the original input:
 #define COPY_YYTEXT_ORIG() copy_input_span((parser_data *)G->data, thunk->begin, thunk->end)
@@ -1135,6 +1575,7 @@ YY_LOCAL(int) yyrefill(GREG *G)
 
 YY_LOCAL(int) yymatchDot(GREG *G)
 {
+  if (ABORTED()) return 0;
   if (G->pos >= G->limit && !yyrefill(G)) return 0;
   ++G->pos;
   return 1;
@@ -1142,6 +1583,7 @@ YY_LOCAL(int) yymatchDot(GREG *G)
 
 YY_LOCAL(int) yymatchChar(GREG *G, int c)
 {
+  if (ABORTED()) return 0;
   if (G->pos >= G->limit && !yyrefill(G)) return 0;
   if ((unsigned char)G->buf[G->pos] == c)
     {
@@ -1156,6 +1598,7 @@ YY_LOCAL(int) yymatchChar(GREG *G, int c)
 YY_LOCAL(int) yymatchString(GREG *G, char *s)
 {
   int yysav= G->pos;
+  if (ABORTED()) return 0;
   while (*s)
     {
       if (G->pos >= G->limit && !yyrefill(G)) return 0;
@@ -1172,6 +1615,7 @@ YY_LOCAL(int) yymatchString(GREG *G, char *s)
 
 YY_LOCAL(int) yymatchClass(GREG *G, unsigned char *bits)
 {
+  if (ABORTED()) return 0;
   int c;
   if (G->pos >= G->limit && !yyrefill(G)) return 0;
   c= (unsigned char)G->buf[G->pos];
@@ -1256,7 +1700,17 @@ YY_LOCAL(int) yyAccept(GREG *G, int tp0)
   return 1;
 }
 
-YY_LOCAL(void) yyPush(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR) { G->val += count; }
+YY_LOCAL(void) yyPush(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)
+{
+  int off= (G->val - G->vals) + count;
+  if (off >= G->valslen)
+    {
+      while (G->valslen <= off)
+        G->valslen *= 2;
+      G->vals= (YYSTYPE *)YY_REALLOC(G->vals, sizeof(YYSTYPE) * G->valslen, G->data);
+    }
+  G->val= G->vals + off;
+}
 YY_LOCAL(void) yyPop(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val -= count; }
 YY_LOCAL(void) yySet(GREG *G, char *text, int count, yythunk *thunk, YY_XTYPE YY_XVAR)  { G->val[count]= G->ss; }
 
@@ -1582,8 +2036,8 @@ YY_ACTION(void) yy_1_Reference(GREG *G, char *yytext, int yyleng, yythunk *thunk
   yyprintf((stderr, "do yy_1_Reference\n"));
   
                 pmh_realelement *el = elem_s(pmh_REFERENCE);
-                el->label = strdup_or_null(l->label);
-                el->address = strdup_or_null(r->address);
+                el->label = COPY_STR(l->label);
+                el->address = COPY_STR(r->address);
                 ADD(el);
                 FREE_LABEL(l);
                 FREE_ADDRESS(r);
@@ -1663,7 +2117,7 @@ YY_ACTION(void) yy_1_ExplicitLink(GREG *G, char *yytext, int yyleng, yythunk *th
   
                     yy = elem_s(pmh_LINK);
                     if (l->address != NULL)
-                        yy->address = strdup_or_null(l->address);
+                        yy->address = COPY_STR(l->address);
                     FREE_LABEL(s);
                     FREE_ADDRESS(l);
                 ;
@@ -1678,8 +2132,8 @@ YY_ACTION(void) yy_1_ReferenceLinkSingle(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(s->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(s->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = COPY_STR(s->label);
+                                yy->address = COPY_STR(reference->address);
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -1695,8 +2149,8 @@ YY_ACTION(void) yy_1_ReferenceLinkDouble(GREG *G, char *yytext, int yyleng, yyth
                         	pmh_realelement *reference = GET_REF(l->label);
                             if (reference) {
                                 yy = elem_s(pmh_LINK);
-                                yy->label = strdup_or_null(l->label);
-                                yy->address = strdup_or_null(reference->address);
+                                yy->label = COPY_STR(l->label);
+                                yy->address = COPY_STR(reference->address);
                             } else
                                 yy = NULL;
                             FREE_LABEL(s);
@@ -2559,8 +3013,8 @@ YY_RULE(int) yy_Source(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Source", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Label(GREG *G)
-{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+YY_RULE(int) yy_Label_unmemoized(GREG *G)
+{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  size_t yytail0;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "Label"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l143;  if (!yy_LocMarker(G)) { goto l143; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '[')) goto l143;
   {  int yypos144= G->pos, yythunkpos144= G->thunkpos;
   {  int yypos146= G->pos, yythunkpos146= G->thunkpos;  if (!yymatchChar(G, '^')) goto l146;  goto l145;
@@ -2570,16 +3024,17 @@ YY_RULE(int) yy_Label(GREG *G)
   {  int yypos147= G->pos, yythunkpos147= G->thunkpos;  if (!yymatchDot(G)) goto l143;  G->pos= yypos147; G->thunkpos= yythunkpos147;
   }  yyText(G, G->begin, G->end);  if (!( !EXT(pmh_EXT_NOTES) )) goto l143;
   }
-  l144:;	  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l143;
-  l148:;	
+  l144:;	  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l143;  yytail0= loop_tail_begin(G);
+  l148:;	  if (loop_tail_visit(G, PACKRAT_LabelTail)) goto l1471;
   {  int yypos149= G->pos, yythunkpos149= G->thunkpos;
   {  int yypos150= G->pos, yythunkpos150= G->thunkpos;  if (!yymatchChar(G, ']')) goto l150;  goto l149;
   l150:;	  G->pos= yypos150; G->thunkpos= yythunkpos150;
   }  if (!yy_Inline(G)) { goto l149; }  goto l148;
   l149:;	  G->pos= yypos149; G->thunkpos= yythunkpos149;
-  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l143;  yyDo(G, yy_1_Label, G->begin, G->end);  if (!yymatchChar(G, ']')) goto l143;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l143;  yyDo(G, yy_2_Label, G->begin, G->end);
+  }  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1471;  yyDo(G, yy_1_Label, G->begin, G->end);  if (!yymatchChar(G, ']')) goto l1471;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1471;  yyDo(G, yy_2_Label, G->begin, G->end);  loop_tail_end(G, yytail0, 0);
   yyprintf((stderr, "  ok   %s @ %s\n", "Label", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
+  l1471:;	  loop_tail_end(G, yytail0, 1);
   l143:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "Label", G->buf+G->pos));
   return 0;
@@ -2644,8 +3099,8 @@ YY_RULE(int) yy_ExplicitLink(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "ExplicitLink", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_StrongUl(GREG *G)
-{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+YY_RULE(int) yy_StrongUl_unmemoized(GREG *G)
+{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  size_t yytail0;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "StrongUl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l163;  if (!yy_LocMarker(G)) { goto l163; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "__")) goto l163;
   {  int yypos164= G->pos, yythunkpos164= G->thunkpos;  if (!yy_Whitespace(G)) { goto l164; }  goto l163;
   l164:;	  G->pos= yypos164; G->thunkpos= yythunkpos164;
@@ -2653,21 +3108,23 @@ YY_RULE(int) yy_StrongUl(GREG *G)
   {  int yypos167= G->pos, yythunkpos167= G->thunkpos;  if (!yymatchString(G, "__")) goto l167;  goto l163;
   l167:;	  G->pos= yypos167; G->thunkpos= yythunkpos167;
   }  if (!yy_Inline(G)) { goto l163; }
-  l165:;	
+  yytail0= loop_tail_begin(G);
+  l165:;	  if (loop_tail_visit(G, PACKRAT_StrongUlTail)) goto l1472;
   {  int yypos166= G->pos, yythunkpos166= G->thunkpos;
   {  int yypos168= G->pos, yythunkpos168= G->thunkpos;  if (!yymatchString(G, "__")) goto l168;  goto l166;
   l168:;	  G->pos= yypos168; G->thunkpos= yythunkpos168;
   }  if (!yy_Inline(G)) { goto l166; }  goto l165;
   l166:;	  G->pos= yypos166; G->thunkpos= yythunkpos166;
-  }  if (!yymatchString(G, "__")) goto l163;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l163;  yyDo(G, yy_1_StrongUl, G->begin, G->end);
+  }  if (!yymatchString(G, "__")) goto l1472;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1472;  yyDo(G, yy_1_StrongUl, G->begin, G->end);  loop_tail_end(G, yytail0, 0);
   yyprintf((stderr, "  ok   %s @ %s\n", "StrongUl", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
+  l1472:;	  loop_tail_end(G, yytail0, 1);
   l163:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "StrongUl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_StrongStar(GREG *G)
-{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+YY_RULE(int) yy_StrongStar_unmemoized(GREG *G)
+{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  size_t yytail0;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "StrongStar"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l169;  if (!yy_LocMarker(G)) { goto l169; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "**")) goto l169;
   {  int yypos170= G->pos, yythunkpos170= G->thunkpos;  if (!yy_Whitespace(G)) { goto l170; }  goto l169;
   l170:;	  G->pos= yypos170; G->thunkpos= yythunkpos170;
@@ -2675,15 +3132,17 @@ YY_RULE(int) yy_StrongStar(GREG *G)
   {  int yypos173= G->pos, yythunkpos173= G->thunkpos;  if (!yymatchString(G, "**")) goto l173;  goto l169;
   l173:;	  G->pos= yypos173; G->thunkpos= yythunkpos173;
   }  if (!yy_Inline(G)) { goto l169; }
-  l171:;	
+  yytail0= loop_tail_begin(G);
+  l171:;	  if (loop_tail_visit(G, PACKRAT_StrongStarTail)) goto l1473;
   {  int yypos172= G->pos, yythunkpos172= G->thunkpos;
   {  int yypos174= G->pos, yythunkpos174= G->thunkpos;  if (!yymatchString(G, "**")) goto l174;  goto l172;
   l174:;	  G->pos= yypos174; G->thunkpos= yythunkpos174;
   }  if (!yy_Inline(G)) { goto l172; }  goto l171;
   l172:;	  G->pos= yypos172; G->thunkpos= yythunkpos172;
-  }  if (!yymatchString(G, "**")) goto l169;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l169;  yyDo(G, yy_1_StrongStar, G->begin, G->end);
+  }  if (!yymatchString(G, "**")) goto l1473;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1473;  yyDo(G, yy_1_StrongStar, G->begin, G->end);  loop_tail_end(G, yytail0, 0);
   yyprintf((stderr, "  ok   %s @ %s\n", "StrongStar", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
+  l1473:;	  loop_tail_end(G, yytail0, 1);
   l169:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "StrongStar", G->buf+G->pos));
   return 0;
@@ -2701,8 +3160,8 @@ YY_RULE(int) yy_Whitespace(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Whitespace", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_EmphUl(GREG *G)
-{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+YY_RULE(int) yy_EmphUl_unmemoized(GREG *G)
+{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  size_t yytail0;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "EmphUl"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l178;  if (!yy_LocMarker(G)) { goto l178; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '_')) goto l178;
   {  int yypos179= G->pos, yythunkpos179= G->thunkpos;  if (!yy_Whitespace(G)) { goto l179; }  goto l178;
   l179:;	  G->pos= yypos179; G->thunkpos= yythunkpos179;
@@ -2714,7 +3173,8 @@ YY_RULE(int) yy_EmphUl(GREG *G)
   l183:;	  G->pos= yypos182; G->thunkpos= yythunkpos182;  if (!yy_StrongUl(G)) { goto l178; }
   }
   l182:;	
-  l180:;	
+  yytail0= loop_tail_begin(G);
+  l180:;	  if (loop_tail_visit(G, PACKRAT_EmphUlTail)) goto l1474;
   {  int yypos181= G->pos, yythunkpos181= G->thunkpos;
   {  int yypos185= G->pos, yythunkpos185= G->thunkpos;
   {  int yypos187= G->pos, yythunkpos187= G->thunkpos;  if (!yymatchChar(G, '_')) goto l187;  goto l186;
@@ -2724,15 +3184,16 @@ YY_RULE(int) yy_EmphUl(GREG *G)
   }
   l185:;	  goto l180;
   l181:;	  G->pos= yypos181; G->thunkpos= yythunkpos181;
-  }  if (!yymatchChar(G, '_')) goto l178;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l178;  yyDo(G, yy_1_EmphUl, G->begin, G->end);
+  }  if (!yymatchChar(G, '_')) goto l1474;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1474;  yyDo(G, yy_1_EmphUl, G->begin, G->end);  loop_tail_end(G, yytail0, 0);
   yyprintf((stderr, "  ok   %s @ %s\n", "EmphUl", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
+  l1474:;	  loop_tail_end(G, yytail0, 1);
   l178:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "EmphUl", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_EmphStar(GREG *G)
-{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+YY_RULE(int) yy_EmphStar_unmemoized(GREG *G)
+{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  size_t yytail0;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "EmphStar"));  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l188;  if (!yy_LocMarker(G)) { goto l188; }  yyDo(G, yySet, -1, 0);  if (!yymatchChar(G, '*')) goto l188;
   {  int yypos189= G->pos, yythunkpos189= G->thunkpos;  if (!yy_Whitespace(G)) { goto l189; }  goto l188;
   l189:;	  G->pos= yypos189; G->thunkpos= yythunkpos189;
@@ -2744,7 +3205,8 @@ YY_RULE(int) yy_EmphStar(GREG *G)
   l193:;	  G->pos= yypos192; G->thunkpos= yythunkpos192;  if (!yy_StrongStar(G)) { goto l188; }
   }
   l192:;	
-  l190:;	
+  yytail0= loop_tail_begin(G);
+  l190:;	  if (loop_tail_visit(G, PACKRAT_EmphStarTail)) goto l1475;
   {  int yypos191= G->pos, yythunkpos191= G->thunkpos;
   {  int yypos195= G->pos, yythunkpos195= G->thunkpos;
   {  int yypos197= G->pos, yythunkpos197= G->thunkpos;  if (!yymatchChar(G, '*')) goto l197;  goto l196;
@@ -2754,9 +3216,10 @@ YY_RULE(int) yy_EmphStar(GREG *G)
   }
   l195:;	  goto l190;
   l191:;	  G->pos= yypos191; G->thunkpos= yythunkpos191;
-  }  if (!yymatchChar(G, '*')) goto l188;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l188;  yyDo(G, yy_1_EmphStar, G->begin, G->end);
+  }  if (!yymatchChar(G, '*')) goto l1475;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1475;  yyDo(G, yy_1_EmphStar, G->begin, G->end);  loop_tail_end(G, yytail0, 0);
   yyprintf((stderr, "  ok   %s @ %s\n", "EmphStar", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
+  l1475:;	  loop_tail_end(G, yytail0, 1);
   l188:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "EmphStar", G->buf+G->pos));
   return 0;
@@ -3553,8 +4016,8 @@ YY_RULE(int) yy_Image(GREG *G)
   yyprintf((stderr, "  fail %s @ %s\n", "Image", G->buf+G->pos));
   return 0;
 }
-YY_RULE(int) yy_Strike(GREG *G)
-{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  yyDo(G, yyPush, 1, 0);
+YY_RULE(int) yy_Strike_unmemoized(GREG *G)
+{  int yypos0= G->pos, yythunkpos0= G->thunkpos;  size_t yytail0;  yyDo(G, yyPush, 1, 0);
   yyprintf((stderr, "%s\n", "Strike"));  yyText(G, G->begin, G->end);  if (!( EXT(pmh_EXT_STRIKE) )) goto l570;  yyText(G, G->begin, G->end);  if (!(YY_BEGIN)) goto l570;  if (!yy_LocMarker(G)) { goto l570; }  yyDo(G, yySet, -1, 0);  if (!yymatchString(G, "~~")) goto l570;
   {  int yypos571= G->pos, yythunkpos571= G->thunkpos;  if (!yy_Whitespace(G)) { goto l571; }  goto l570;
   l571:;	  G->pos= yypos571; G->thunkpos= yythunkpos571;
@@ -3562,15 +4025,17 @@ YY_RULE(int) yy_Strike(GREG *G)
   {  int yypos574= G->pos, yythunkpos574= G->thunkpos;  if (!yymatchString(G, "~~")) goto l574;  goto l570;
   l574:;	  G->pos= yypos574; G->thunkpos= yythunkpos574;
   }  if (!yy_Inline(G)) { goto l570; }
-  l572:;	
+  yytail0= loop_tail_begin(G);
+  l572:;	  if (loop_tail_visit(G, PACKRAT_StrikeTail)) goto l1476;
   {  int yypos573= G->pos, yythunkpos573= G->thunkpos;
   {  int yypos575= G->pos, yythunkpos575= G->thunkpos;  if (!yymatchString(G, "~~")) goto l575;  goto l573;
   l575:;	  G->pos= yypos575; G->thunkpos= yythunkpos575;
   }  if (!yy_Inline(G)) { goto l573; }  goto l572;
   l573:;	  G->pos= yypos573; G->thunkpos= yythunkpos573;
-  }  if (!yymatchString(G, "~~")) goto l570;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l570;  yyDo(G, yy_1_Strike, G->begin, G->end);
+  }  if (!yymatchString(G, "~~")) goto l1476;  yyText(G, G->begin, G->end);  if (!(YY_END)) goto l1476;  yyDo(G, yy_1_Strike, G->begin, G->end);  loop_tail_end(G, yytail0, 0);
   yyprintf((stderr, "  ok   %s @ %s\n", "Strike", G->buf+G->pos));  yyDo(G, yyPop, 1, 0);
   return 1;
+  l1476:;	  loop_tail_end(G, yytail0, 1);
   l570:;	  G->pos= yypos0; G->thunkpos= yythunkpos0;
   yyprintf((stderr, "  fail %s @ %s\n", "Strike", G->buf+G->pos));
   return 0;
@@ -6522,14 +6987,132 @@ YY_PARSE(void) YY_NAME(parse_free)(GREG *G)
  */
 
 
+
+static void memo_set_failed(packrat_memo *memo, size_t pos, int rule)
+{
+    memo->failed[pos] |= (unsigned short)(1 << rule);
+    if (pos >= memo->high_water)
+        memo->high_water = pos + 1;
+}
+
+/*
+Parse rule @rule by @body. Failing with no side effect, a rule fails again
+at the same position of the same run, so the failure is remembered.
+*/
+static int memoized_rule(GREG *G, int rule, yyrule body)
+{
+    packrat_memo *memo = ((parser_data *)G->data)->memo;
+    size_t pos = G->offset + G->pos;
+    if (memo == NULL || pos >= memo->capacity)
+        return body(G);
+    
+    unsigned short bit = (unsigned short)(1 << rule);
+    if (memo->failed[pos] & bit)
+        return 0;
+    if (body(G))
+        return 1;
+    
+    memo_set_failed(memo, pos, rule);
+    return 0;
+}
+
+#define MEMOIZED_RULE(name)                                             \
+    YY_RULE(int) yy_##name(GREG *G)                                     \
+    {                                                                   \
+        return memoized_rule(G, PACKRAT_##name, yy_##name##_unmemoized); \
+    }
+
+MEMOIZED_RULE(Label)
+MEMOIZED_RULE(StrongStar)
+MEMOIZED_RULE(StrongUl)
+MEMOIZED_RULE(EmphStar)
+MEMOIZED_RULE(EmphUl)
+MEMOIZED_RULE(Strike)
+
+/*
+Memoizing the failure of a rule alone is not enough for a run of unclosed
+markers: each one still loops over Inline up to the end of the paragraph.
+But the loop is greedy, so whether it ends at the closing marker depends
+only on the position of an iteration. Once such a rule fails, every position
+where its loop started an iteration is remembered, and the loops of the
+following ones give up as soon as they reach one of them.
+*/
+
+// Return the base of the positions to be visited by the loop of a rule.
+static size_t loop_tail_begin(GREG *G)
+{
+    packrat_memo *memo = ((parser_data *)G->data)->memo;
+    return memo == NULL ? 0 : memo->tail_len;
+}
+
+// Called before each iteration of a loop whose tail is memoized by bit
+// @tail. Return true if the loop is known to reach no closing marker from
+// current position.
+static int loop_tail_visit(GREG *G, int tail)
+{
+    packrat_memo *memo = ((parser_data *)G->data)->memo;
+    size_t pos = G->offset + G->pos;
+    if (memo == NULL || pos >= memo->capacity)
+        return 0;
+    
+    if (memo->failed[pos] & (1 << tail))
+        return 1;
+    
+    if (memo->tail_len == memo->tail_cap) {
+        size_t cap = memo->tail_cap == 0 ? 64 : memo->tail_cap * 2;
+        size_t *positions = (size_t *)realloc(memo->tail, cap * sizeof(size_t));
+        if (positions == NULL)
+            return 0;
+        memo->tail = positions;
+        memo->tail_cap = cap;
+    }
+    
+    // The bit to set is kept in the low bits. Marking only the positions
+    // recorded is still correct:
+    memo->tail[memo->tail_len++] = (pos << 4) | tail;
+    return 0;
+}
+
+// Drop the positions visited by the loop of @base, marking them if the
+// rule has @failed.
+static void loop_tail_end(GREG *G, size_t base, int failed)
+{
+    packrat_memo *memo = ((parser_data *)G->data)->memo;
+    if (memo == NULL)
+        return;
+    
+    if (failed) {
+        for (size_t i = base; i < memo->tail_len; ++i)
+            memo_set_failed(memo, memo->tail[i] >> 4, memo->tail[i] & 0xf);
+    }
+    
+    memo->tail_len = base;
+}
+
+
 static void _parse(parser_data *p_data, yyrule start_rule)
 {
-    GREG *g = YY_NAME(parse_new)(p_data);
+    // Reuse the scratch buffers of the previous runs:
+    GREG *g = p_data->arena->greg;
+    if (g == NULL)
+        g = p_data->arena->greg = YY_NAME(parse_new)(p_data);
+    else {
+        g->data = p_data;
+        g->offset = g->limit = 0;
+    }
+    
+    // Positions of this run refer to a different input:
+    packrat_memo *memo = p_data->memo;
+    if (memo != NULL) {
+        memset(memo->failed, 0, memo->high_water * sizeof(unsigned short));
+        memo->high_water = 0;
+        memo->tail_len = 0;
+    }
+    
     if (start_rule == NULL)
         YY_NAME(parse)(g);
     else
         YY_NAME(parse_from)(g, start_rule);
-    YY_NAME(parse_free)(g);
     
     pmh_PRINTF("\n\n");
 }
@@ -6553,3 +7136,17 @@ static void parse_references(parser_data *p_data)
     p_data->head_elems[pmh_REFERENCE] = NULL;
 }
 
+void pmh_arena_free(pmh_arena *arena)
+{
+    pmh_arena_slab *slab = arena->slabs;
+    while (slab != NULL) {
+        pmh_arena_slab *tofree = slab;
+        slab = slab->next;
+        free(tofree);
+    }
+    
+    if (arena->greg != NULL)
+        YY_NAME(parse_free)(arena->greg);
+    
+    free(arena);
+}
@@ -41,6 +41,147 @@
 void pmh_markdown_to_elements(char *text, int extensions,
                               pmh_element **out_result[]);
 
+/**
+* \brief Memory arena for the results of parsing
+* 
+* All the memory needed by a parse is allocated from large slabs of an
+* arena, which are released at once. An arena may be reused across parses
+* to avoid allocating from the heap in steady state. An arena must not be
+* used by more than one parse at a time.
+*/
+typedef struct pmh_Arena pmh_arena;
+
+/**
+* \brief Create an arena
+* 
+* \return A new empty arena. You must pass this to pmh_arena_free() when
+*         it's not needed anymore.
+* 
+* \sa pmh_markdown_to_elements_abortable
+*/
+pmh_arena *pmh_arena_new();
+
+/**
+* \brief Reset an arena
+* 
+* Releases all the memory allocated from the arena for reuse, keeping
+* its slabs. Elements returned by a parse using the arena become invalid.
+* 
+* \param[in]  arena  The arena to reset.
+*/
+void pmh_arena_reset(pmh_arena *arena);
+
+/**
+* \brief Free an arena
+* 
+* \param[in]  arena  The arena returned by pmh_arena_new().
+*/
+void pmh_arena_free(pmh_arena *arena);
+
+/**
+* \brief Parse status returned by pmh_markdown_to_elements_abortable().
+*/
+enum pmh_parse_status
+{
+    pmh_PARSE_OK        = 0, /**< Parsing finished */
+    pmh_PARSE_CANCELLED = 1, /**< Parsing was cancelled via the cancel flag */
+    pmh_PARSE_TIMEOUT   = 2  /**< Parsing exceeded its time budget */
+};
+
+/**
+* \brief Callback polled to see whether to cancel the parsing
+* 
+* Called on the parsing thread with the context given along with it.
+* Returns non-zero to cancel. It should synchronize with the thread
+* requesting the cancellation, e.g. by an atomic load with acquire
+* semantics.
+*/
+typedef int (*pmh_cancel_callback)(void *context);
+
+/**
+* \brief Parse Markdown text with cancellation and a time budget
+* 
+* Like pmh_markdown_to_elements(), but the parsing is abandoned once
+* cancel_callback returns non-zero or once it takes longer than
+* time_budget_ms milliseconds. Both are polled periodically while the
+* parser consumes input.
+* 
+* \param[in]  text            The Markdown text to parse for highlighting.
+* \param[in]  extensions      The extensions to use in parsing (a bitfield
+*                             of pmh_extensions values).
+* \param[out] out_result      As in pmh_markdown_to_elements(). Set to NULL
+*                             if the parsing is abandoned.
+* \param[in]  arena           The arena to allocate the results from. It is
+*                             reset before parsing, invalidating the results
+*                             of the previous parse using it. May be NULL to
+*                             use an arena of this parse only.
+* \param[in]  cancel_callback Callback to cancel the parsing from another
+*                             thread. May be NULL.
+* \param[in]  cancel_context  Context passed to cancel_callback.
+* \param[in]  time_budget_ms  Time budget in milliseconds. 0 for no limit.
+* 
+* \return A pmh_parse_status value.
+* 
+* \sa pmh_markdown_to_elements
+*/
+int pmh_markdown_to_elements_abortable(char *text, int extensions,
+                                       pmh_element **out_result[],
+                                       pmh_arena *arena,
+                                       pmh_cancel_callback cancel_callback,
+                                       void *cancel_context,
+                                       unsigned long time_budget_ms);
+
+/**
+* \brief Text already preformatted for the parser
+* 
+* Lets the caller transcode its text for the parser in one pass instead of
+* passing UTF-8 to be preformatted.
+*/
+typedef struct
+{
+    /**
+    * One byte per code point of the text (the first byte of its UTF-8
+    * encoding), followed by "\n\n" and a terminating null byte.
+    */
+    char *charbuf;
+    
+    /** The original text as UTF-16, to copy labels and addresses from. */
+    const unsigned short *utf16;
+    
+    /** Ascending offsets in charbuf of the code points outside the BMP. */
+    const unsigned long *astral_positions;
+    size_t astral_positions_len;
+} pmh_preformatted_input;
+
+/**
+* \brief Parse preformatted Markdown text
+* 
+* Like pmh_markdown_to_elements_abortable(), but takes text already
+* preformatted by the caller. The offsets of the resulting elements are
+* offsets in input->charbuf, i.e. in code points of the text.
+* 
+* \param[in]  input           The preformatted text to parse. It is only
+*                             accessed during the call.
+* \param[in]  extensions      The extensions to use in parsing (a bitfield
+*                             of pmh_extensions values).
+* \param[out] out_result      As in pmh_markdown_to_elements_abortable().
+* \param[in]  arena           As in pmh_markdown_to_elements_abortable().
+* \param[in]  cancel_callback As in pmh_markdown_to_elements_abortable().
+* \param[in]  cancel_context  As in pmh_markdown_to_elements_abortable().
+* \param[in]  time_budget_ms  As in pmh_markdown_to_elements_abortable().
+* 
+* \return A pmh_parse_status value.
+* 
+* \sa pmh_markdown_to_elements_abortable
+*/
+int pmh_preformatted_to_elements(const pmh_preformatted_input *input,
+                                 int extensions,
+                                 pmh_element **out_result[],
+                                 pmh_arena *arena,
+                                 pmh_cancel_callback cancel_callback,
+                                 void *cancel_context,
+                                 unsigned long time_budget_ms);
+
 /**
 * \brief Sort elements in list by start offset.
 * 
@@ -59,6 +200,8 @@ void pmh_sort_elements_by_pos(pmh_element *element_lists[]);
 * \brief Free pmh_element array
 * 
 * Frees an pmh_element array returned by pmh_markdown_to_elements().
+* If the elements were allocated from an arena passed by the caller,
+* the arena is reset rather than freed, keeping its memory for reuse.
 * 
 * \param[in]  elems  The pmh_element array resulting from calling
 *                    pmh_markdown_to_elements().
@@ -2,6 +2,9 @@
 #include <QValidator>
 #include <QRegExp>
 #include "vinsertimagedialog.h"
+#include "vimagecache.h"
+
+const int VInsertImageDialog::c_previewWidth = 256;
 
 VInsertImageDialog::VInsertImageDialog(const QString &title, const QString &defaultImageTitle,
                                        const QString &defaultPath, QWidget *parent)
@@ -102,7 +105,8 @@ void VInsertImageDialog::handleBrowseBtnClicked()
     lastPath = QFileInfo(filePath).path();
 
     pathEdit->setText(filePath);
-    QImage image(filePath);
+    // Only the preview is needed. The file is inserted by its path.
+    QImage image = VImageCache::load(filePath, c_previewWidth).m_image;
     if (image.isNull()) {
         return;
     }
@@ -112,7 +116,7 @@ void VInsertImageDialog::handleBrowseBtnClicked()
 void VInsertImageDialog::setImage(const QImage &image)
 {
     Q_ASSERT(!image.isNull());
-    QSize previewSize(256, 256);
+    QSize previewSize(c_previewWidth, c_previewWidth);
     if (!this->image) {
         this->image = new QImage(image);
     } else {
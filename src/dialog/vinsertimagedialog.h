@@ -26,6 +26,9 @@ public:
     QImage getImage() const;
     void setBrowseable(bool browseable, bool visible = false);
 
+    // Size of the preview of the image.
+    static const int c_previewWidth;
+
 public slots:
     void imageDownloaded(const QByteArray &data);
 
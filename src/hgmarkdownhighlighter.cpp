@@ -1,36 +1,39 @@
 #include <QtGui>
 #include <QtDebug>
 #include <QTextCursor>
+#include <QElapsedTimer>
 #include <algorithm>
 #include "hgmarkdownhighlighter.h"
 #include "vconfigmanager.h"
 #include "utils/vutils.h"
+#include "vpegparser.h"
+#include "vtextblockdata.h"
 
 extern VConfigManager vconfig;
 
-const int HGMarkdownHighlighter::initCapacity = 1024;
+const unsigned long HGMarkdownHighlighter::c_initParseTimeBudget = 2000;
+const unsigned long HGMarkdownHighlighter::c_maxParseTimeBudget = 16000;
 
-void HGMarkdownHighlighter::resizeBuffer(int newCap)
+const int HGMarkdownHighlighter::c_lazyHighlightMargin = 50;
+
+const int HGMarkdownHighlighter::c_lazyHighlightSliceTime = 10;
+
+static inline uint combineHash(uint p_seed, uint p_val)
 {
-    if (newCap == capacity) {
-        return;
-    }
-    if (capacity > 0) {
-        Q_ASSERT(content);
-        delete [] content;
-    }
-    capacity = newCap;
-    content = new char [capacity];
+    return p_seed ^ (p_val + 0x9e3779b9 + (p_seed << 6) + (p_seed >> 2));
 }
 
 // Will be freeed by parent automatically
 HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &styles,
-                                             const QHash<QString, QTextCharFormat> &codeBlockStyles,
-                                             int waitInterval,
+                                             const HLCodeBlockFormats &p_codeBlockFormats,
                                              QTextDocument *parent)
     : QSyntaxHighlighter(parent), highlightingStyles(styles),
-      m_codeBlockStyles(codeBlockStyles), m_numOfCodeBlockHighlightsToRecv(0),
-      parsing(0), waitInterval(waitInterval), content(NULL), capacity(0), result(NULL)
+      m_codeBlockFormats(p_codeBlockFormats), m_numOfCodeBlockHighlightsToRecv(0),
+      m_dirtyStart(-1), m_dirtyEnd(-1), m_fullParseRequired(true),
+      m_timeStamp(0), m_parseTimeBudget(c_initParseTimeBudget),
+      m_firstVisibleBlock(-1), m_lastVisibleBlock(-1), m_lazyBlockNum(-1),
+      m_parseDelay(vconfig.getMinHighlightDelay(), vconfig.getMaxHighlightDelay()),
+      m_completeDelay(vconfig.getMinOutlineDelay(), vconfig.getMaxOutlineDelay())
 {
     codeBlockStartExp = QRegExp(VUtils::c_fencedCodeBlockStartRegExp);
     codeBlockEndExp = QRegExp(VUtils::c_fencedCodeBlockEndRegExp);
@@ -47,20 +50,28 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
         }
     }
 
-    resizeBuffer(initCapacity);
     document = parent;
 
+    m_parser = new VPegParser(styles, this);
+    connect(m_parser, &VPegParser::parseResultReady,
+            this, &HGMarkdownHighlighter::handleParseResult);
+
     timer = new QTimer(this);
     timer->setSingleShot(true);
-    timer->setInterval(this->waitInterval);
+    timer->setInterval(m_parseDelay.getDelay());
     connect(timer, &QTimer::timeout, this, &HGMarkdownHighlighter::timerTimeout);
 
-    static const int completeWaitTime = 500;
     m_completeTimer = new QTimer(this);
     m_completeTimer->setSingleShot(true);
-    m_completeTimer->setInterval(completeWaitTime);
+    m_completeTimer->setInterval(m_completeDelay.getDelay());
     connect(m_completeTimer, &QTimer::timeout,
-            this, &HGMarkdownHighlighter::highlightCompleted);
+            this, &HGMarkdownHighlighter::completeTimerTimeout);
+
+    m_lazyTimer = new QTimer(this);
+    m_lazyTimer->setSingleShot(true);
+    m_lazyTimer->setInterval(0);
+    connect(m_lazyTimer, &QTimer::timeout,
+            this, &HGMarkdownHighlighter::lazyHighlightSlice);
 
     connect(document, &QTextDocument::contentsChange,
             this, &HGMarkdownHighlighter::handleContentChange);
@@ -68,26 +79,31 @@ HGMarkdownHighlighter::HGMarkdownHighlighter(const QVector<HighlightingStyle> &s
 
 HGMarkdownHighlighter::~HGMarkdownHighlighter()
 {
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
-    }
-    if (content) {
-        delete [] content;
-        capacity = 0;
-        content = NULL;
-    }
 }
 
 void HGMarkdownHighlighter::highlightBlock(const QString &text)
 {
     int blockNum = currentBlock().blockNumber();
-    if (!parsing && blockHighlights.size() > blockNum) {
-        const QVector<HLUnit> &units = blockHighlights[blockNum];
-        for (int i = 0; i < units.size(); ++i) {
-            // TODO: merge two format within the same range
-            const HLUnit &unit = units[i];
-            setFormat(unit.start, unit.length, highlightingStyles[unit.styleIndex].format);
+    int oldState = currentBlockState();
+
+    // Record what the block is formatted with.
+    VTextBlockData *blockData = static_cast<VTextBlockData *>(currentBlockUserData());
+    if (!blockData) {
+        blockData = new VTextBlockData();
+        setCurrentBlockUserData(blockData);
+    }
+
+    blockData->setHighlightHash(highlightHash(currentBlock()));
+
+    // All the formats are painted as layers and applied as non-overlapping
+    // runs of merged formats at last.
+    m_runBuilder.reset(text.length());
+
+    if (blockHighlights.blockCount() > blockNum) {
+        const HLUnit *end = blockHighlights.end(blockNum);
+        for (const HLUnit *unit = blockHighlights.begin(blockNum); unit != end; ++unit) {
+            m_runBuilder.addLayer(unit->start, unit->length,
+                                  &highlightingStyles.at(unit->styleIndex).format);
         }
     }
 
@@ -108,129 +124,67 @@ void HGMarkdownHighlighter::highlightBlock(const QString &text)
     highlightLinkWithSpacesInURL(text);
 
     // Highlight CodeBlock using VCodeBlockHighlightHelper.
-    if (m_codeBlockHighlights.size() > blockNum) {
-        const QVector<HLUnitStyle> &units = m_codeBlockHighlights[blockNum];
-        // Manually simply merge the format of all the units within the same block.
-        // Using QTextCursor to get the char format after setFormat() seems
-        // not to work.
-        QVector<QTextCharFormat> formats;
-        formats.reserve(units.size());
-        // formatIndex[i] is the index in @formats which is the format of the
-        // ith character.
-        QVector<int> formatIndex(currentBlock().length(), -1);
-        for (int i = 0; i < units.size(); ++i) {
-            const HLUnitStyle &unit = units[i];
-            auto it = m_codeBlockStyles.find(unit.style);
-            if (it != m_codeBlockStyles.end()) {
-                QTextCharFormat newFormat;
-                if (unit.start < (unsigned int)formatIndex.size() && formatIndex[unit.start] != -1) {
-                    newFormat = formats[formatIndex[unit.start]];
-                    newFormat.merge(*it);
-                } else {
-                    newFormat = *it;
-                }
-                setFormat(unit.start, unit.length, newFormat);
-
-                formats.append(newFormat);
-                int idx = formats.size() - 1;
-                unsigned int endIdx = unit.length + unit.start;
-                for (unsigned int i = unit.start; i < endIdx && i < (unsigned int)formatIndex.size(); ++i) {
-                    formatIndex[i] = idx;
-                }
+    if (m_codeBlockHighlights.blockCount() > blockNum) {
+        const QVector<QTextCharFormat> &formats = m_codeBlockFormats.m_formats;
+        int nrStyles = formats.size();
+
+        // Units are sorted by start and a nested unit follows the one
+        // enclosing it, whose format is merged with its own.
+        QVarLengthArray<const HLUnitStyle *, 8> enclosingUnits;
+        const HLUnitStyle *end = m_codeBlockHighlights.end(blockNum);
+        for (const HLUnitStyle *it = m_codeBlockHighlights.begin(blockNum); it != end; ++it) {
+            const HLUnitStyle &unit = *it;
+            if (unit.styleId >= nrStyles || formats[unit.styleId].propertyCount() == 0) {
+                continue;
             }
-        }
-    }
-
-exit:
-    highlightChanged();
-}
-
-void HGMarkdownHighlighter::initBlockHighlightFromResult(int nrBlocks)
-{
-    blockHighlights.resize(nrBlocks);
-    for (int i = 0; i < blockHighlights.size(); ++i) {
-        blockHighlights[i].clear();
-    }
 
-    if (!result) {
-        return;
-    }
+            while (!enclosingUnits.isEmpty()
+                   && enclosingUnits.last()->start + enclosingUnits.last()->length <= unit.start) {
+                enclosingUnits.removeLast();
+            }
 
-    for (int i = 0; i < highlightingStyles.size(); i++)
-    {
-        const HighlightingStyle &style = highlightingStyles[i];
-        pmh_element *elem_cursor = result[style.type];
-        while (elem_cursor != NULL)
-        {
-            // elem_cursor->pos and elem_cursor->end is the start
-            // and end position of the element in document.
-            if (elem_cursor->end <= elem_cursor->pos) {
-                elem_cursor = elem_cursor->next;
-                continue;
+            if (enclosingUnits.isEmpty()) {
+                m_runBuilder.addLayer(unit.start, unit.length, &formats[unit.styleId]);
+            } else {
+                int outer = enclosingUnits.last()->styleId;
+                const QVector<QTextCharFormat> &merged = m_codeBlockFormats.m_mergedFormats;
+                m_runBuilder.addLayer(unit.start, unit.length,
+                                      &merged.at(outer * nrStyles + unit.styleId));
             }
-            initBlockHighlihgtOne(elem_cursor->pos, elem_cursor->end, i);
-            elem_cursor = elem_cursor->next;
+
+            enclosingUnits.append(&unit);
         }
     }
-}
-
-void HGMarkdownHighlighter::initHtmlCommentRegionsFromResult()
-{
-    m_commentRegions.clear();
 
-    if (!result) {
-        return;
+exit:
+    for (auto const & run : m_runBuilder.runs()) {
+        setFormat(run.m_start, run.m_length, *run.m_format);
     }
 
-    pmh_element *elem = result[pmh_COMMENT];
-    while (elem != NULL) {
-        if (elem->end <= elem->pos) {
-            elem = elem->next;
-            continue;
-        }
-
-        m_commentRegions.push_back(VCommentRegion(elem->pos, elem->end));
-
-        elem = elem->next;
+    // A change of the fenced code block or comment state will affect the
+    // following blocks, which is beyond an incremental parse.
+    int newState = currentBlockState();
+    if (oldState != newState
+        && (oldState > HighlightBlockState::Normal || newState > HighlightBlockState::Normal)) {
+        m_fullParseRequired = true;
+        emit blockStatesChanged();
     }
 
-    qDebug() << "highlighter:" << m_commentRegions.size() << "HTML comment regions";
-}
-
-void HGMarkdownHighlighter::initBlockHighlihgtOne(unsigned long pos, unsigned long end, int styleIndex)
-{
-    int startBlockNum = document->findBlock(pos).blockNumber();
-    int endBlockNum = document->findBlock(end).blockNumber();
-    for (int i = startBlockNum; i <= endBlockNum; ++i)
-    {
-        QTextBlock block = document->findBlockByNumber(i);
-        int blockStartPos = block.position();
-        HLUnit unit;
-        if (i == startBlockNum) {
-            unit.start = pos - blockStartPos;
-            unit.length = (startBlockNum == endBlockNum) ?
-                          (end - pos) : (block.length() - unit.start);
-        } else if (i == endBlockNum) {
-            unit.start = 0;
-            unit.length = end - blockStartPos;
-        } else {
-            unit.start = 0;
-            unit.length = block.length();
-        }
-        unit.styleIndex = styleIndex;
-
-        blockHighlights[i].append(unit);
-    }
+    highlightChanged();
 }
 
 void HGMarkdownHighlighter::highlightCodeBlock(const QString &text)
 {
-    static int startLeadingSpaces = -1;
     int length = 0;
     int index = -1;
     int preState = previousBlockState();
     int state = HighlightBlockState::Normal;
 
+    // The fence info is kept in the user data to be picked up by the
+    // following blocks and by updateCodeBlocks().
+    VTextBlockData *blockData = static_cast<VTextBlockData *>(currentBlockUserData());
+    Q_ASSERT(blockData);
+
     if (preState != HighlightBlockState::CodeBlock
         && preState != HighlightBlockState::CodeBlockStart) {
         // Need to find a new code block start.
@@ -241,13 +195,20 @@ void HGMarkdownHighlighter::highlightCodeBlock(const QString &text)
             state = HighlightBlockState::CodeBlockStart;
 
             // The leading spaces of code block start and end must be identical.
-            startLeadingSpaces = codeBlockStartExp.capturedTexts()[1].size();
+            blockData->setCodeBlockIndent(codeBlockStartExp.capturedTexts()[1].size());
+            blockData->setCodeBlockLang(codeBlockStartExp.capturedTexts()[2]);
         } else {
             // A normal block.
-            startLeadingSpaces = -1;
+            blockData->setCodeBlockIndent(-1);
+            blockData->setCodeBlockLang(QString());
             return;
         }
     } else {
+        VTextBlockData *preData = static_cast<VTextBlockData *>(currentBlock().previous().userData());
+        int startLeadingSpaces = preData ? preData->getCodeBlockIndent() : -1;
+        blockData->setCodeBlockIndent(startLeadingSpaces);
+        blockData->setCodeBlockLang(QString());
+
         // Need to find a code block end.
         index = codeBlockEndExp.indexIn(text);
 
@@ -266,7 +227,9 @@ void HGMarkdownHighlighter::highlightCodeBlock(const QString &text)
     }
 
     setCurrentBlockState(state);
-    setFormat(index, length, codeBlockFormat);
+
+    // PEG units within a code block are bogus, so they are hidden.
+    m_runBuilder.addLayer(index, length, &codeBlockFormat, true);
 }
 
 void HGMarkdownHighlighter::highlightLinkWithSpacesInURL(const QString &p_text)
@@ -283,9 +246,9 @@ void HGMarkdownHighlighter::highlightLinkWithSpacesInURL(const QString &p_text)
         QString capturedText = regExp.capturedTexts()[1];
         if (capturedText.contains(' ')) {
             if (p_text[index] == '!' && m_imageFormat.isValid()) {
-                setFormat(index, length, m_imageFormat);
+                m_runBuilder.addLayer(index, length, &m_imageFormat);
             } else if (m_linkFormat.isValid()) {
-                setFormat(index, length, m_linkFormat);
+                m_runBuilder.addLayer(index, length, &m_linkFormat);
             }
         }
         index = regExp.indexIn(p_text, index + length);
@@ -294,73 +257,316 @@ void HGMarkdownHighlighter::highlightLinkWithSpacesInURL(const QString &p_text)
 
 void HGMarkdownHighlighter::parse()
 {
-    if (!parsing.testAndSetRelaxed(0, 1)) {
+    if (highlightingStyles.isEmpty()) {
+        qWarning() << "HighlightingStyles is not set";
         return;
     }
 
-    int nrBlocks = document->blockCount();
-    parseInternal();
+    m_parseCostTimer.start();
 
-    if (highlightingStyles.isEmpty()) {
-        qWarning() << "HighlightingStyles is not set";
-        return;
+    VPegParseConfig config;
+    config.m_timeStamp = m_timeStamp;
+    config.m_timeBudget = m_parseTimeBudget;
+    if (m_fullParseRequired || !prepareIncrementalParse(config)) {
+        prepareFullParse(config);
     }
 
-    initBlockHighlightFromResult(nrBlocks);
+    m_parser->parseAsync(config);
+}
 
-    initHtmlCommentRegionsFromResult();
+void HGMarkdownHighlighter::prepareFullParse(VPegParseConfig &p_config)
+{
+    p_config.m_fullParse = true;
+    p_config.m_offset = 0;
+    p_config.m_startBlock = 0;
+    p_config.m_numOfOldBlocks = blockHighlights.blockCount();
+
+    // Collect the text and block positions in one walk. The parser will
+    // transcode the text itself.
+    QString &text = p_config.m_text;
+    text.reserve(document->characterCount());
+    p_config.m_blockPositions.reserve(document->blockCount());
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        if (block.position() > 0) {
+            text += '\n';
+        }
 
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
+        p_config.m_blockPositions.append(block.position());
+        text += block.text();
     }
 
-    parsing.store(0);
+    p_config.m_length = text.size();
+}
+
+static bool isBlankBlock(const QTextBlock &p_block)
+{
+    return p_block.text().trimmed().isEmpty();
 }
 
-void HGMarkdownHighlighter::parseInternal()
+static bool isIndentedBlock(const QTextBlock &p_block)
 {
-    QString text = document->toPlainText();
-    QByteArray ba = text.toUtf8();
-    const char *data = (const char *)ba.data();
-   int len = ba.size();
+    const QString text = p_block.text();
+    return !text.isEmpty() && text[0].isSpace();
+}
+
+void HGMarkdownHighlighter::expandToTopLevelBlocks(QTextBlock &p_startBlock,
+                                                   QTextBlock &p_endBlock) const
+{
+    // Start block should be a non-indented block after a blank line.
+    while (p_startBlock.previous().isValid()) {
+        if (!isBlankBlock(p_startBlock)
+            && !isIndentedBlock(p_startBlock)
+            && isBlankBlock(p_startBlock.previous())) {
+            break;
+        }
 
-    if (result) {
-        pmh_free_elements(result);
-        result = NULL;
+        p_startBlock = p_startBlock.previous();
     }
 
-    if (len == 0) {
+    // End block should be a blank line followed by a non-indented block.
+    while (p_endBlock.next().isValid()) {
+        QTextBlock next = p_endBlock.next();
+        if (isBlankBlock(p_endBlock)
+            && !isBlankBlock(next)
+            && !isIndentedBlock(next)) {
+            break;
+        }
+
+        p_endBlock = next;
+    }
+}
+
+bool HGMarkdownHighlighter::prepareIncrementalParse(VPegParseConfig &p_config)
+{
+    int nrBlocks = document->blockCount();
+    int oldNrBlocks = blockHighlights.blockCount();
+    if (m_dirtyStart == -1 || oldNrBlocks == 0) {
+        return false;
+    }
+
+    QTextBlock startBlock = document->findBlock(m_dirtyStart);
+    QTextBlock endBlock = document->findBlock(m_dirtyEnd);
+    if (!startBlock.isValid()) {
+        return false;
+    }
+
+    if (!endBlock.isValid()) {
+        endBlock = document->lastBlock();
+    }
+
+    expandToTopLevelBlocks(startBlock, endBlock);
+
+    int startBlockNum = startBlock.blockNumber();
+    int endBlockNum = endBlock.blockNumber();
+    int nrRegionBlocks = endBlockNum - startBlockNum + 1;
+
+    // Blocks after the region are only shifted.
+    int oldNrRegionBlocks = nrRegionBlocks - (nrBlocks - oldNrBlocks);
+    if (oldNrRegionBlocks < 0 || startBlockNum + oldNrRegionBlocks > oldNrBlocks) {
+        return false;
+    }
+
+    // It is not worth it if the region covers most of the document.
+    if (nrRegionBlocks * 2 > nrBlocks) {
+        return false;
+    }
+
+    int startPos = startBlock.position();
+    int endPos = endBlock.position() + endBlock.length() - 1;
+
+    // The region should not cross a structural boundary.
+    int idx = VCommentRegion::lowerBound(m_commentRegions, startPos);
+    if (idx < m_commentRegions.size() && m_commentRegions[idx].intersect(startPos, endPos)) {
+        return false;
+    }
+
+    idx = VCommentRegion::lowerBound(m_htmlBlockRegions, startPos);
+    if (idx < m_htmlBlockRegions.size() && m_htmlBlockRegions[idx].intersect(startPos, endPos)) {
+        return false;
+    }
+
+    QString text;
+    QVector<int> blockPositions;
+    blockPositions.reserve(nrRegionBlocks);
+    for (QTextBlock block = startBlock; block.isValid(); block = block.next()) {
+        if (block.userState() != HighlightBlockState::Normal) {
+            return false;
+        }
+
+        blockPositions.append(block.position() - startPos);
+        text += block.text();
+        if (block == endBlock) {
+            break;
+        }
+
+        text += '\n';
+    }
+
+    if (text.contains("```")
+        || text.contains("<!--")
+        || text.contains("-->")) {
+        return false;
+    }
+
+    // Reference definitions change the meaning of reference links elsewhere.
+    static QRegExp refDefExp("(^|\n) {0,3}\\[[^\\]]+\\]:");
+    if (text.contains(refDefExp)) {
+        return false;
+    }
+
+    p_config.m_fullParse = false;
+    p_config.m_offset = startPos;
+    p_config.m_length = text.size();
+    p_config.m_blockPositions = blockPositions;
+    p_config.m_startBlock = startBlockNum;
+    p_config.m_numOfOldBlocks = oldNrRegionBlocks;
+    if (!m_referenceDefs.isEmpty()) {
+        text += "\n\n";
+        text += m_referenceDefs;
+    }
+
+    p_config.m_text = text;
+
+    qDebug() << "highlighter: incremental parse of blocks" << startBlockNum
+             << "to" << endBlockNum;
+    return true;
+}
+
+void HGMarkdownHighlighter::handleParseResult(const VPegParseResult &p_result)
+{
+    // Abandon obsolete result.
+    if (p_result.m_timeStamp != m_timeStamp) {
+        return;
+    }
+
+    if (p_result.m_status != pmh_PARSE_OK) {
+        // Keep previous highlights and retry with a larger budget.
+        if (p_result.m_status == pmh_PARSE_TIMEOUT) {
+            m_parseDelay.recordCost(m_parseCostTimer.elapsed());
+
+            if (m_parseTimeBudget == 0 || m_parseTimeBudget >= c_maxParseTimeBudget) {
+                m_parseTimeBudget = 0;
+            } else {
+                m_parseTimeBudget *= 2;
+            }
+
+            qDebug() << "highlighter: reschedule parse with time budget" << m_parseTimeBudget;
+            timer->stop();
+            timer->start();
+        }
+
         return;
-    } else if (len >= capacity) {
-        resizeBuffer(qMax(2 * capacity, len * 2));
-    } else if (len < (capacity >> 2)) {
-        resizeBuffer(qMax(capacity >> 1, len * 2));
     }
 
-    memcpy(content, data, len);
-    content[len] = '\0';
+    // Reset the budget after a successful parse, leaving room for a document
+    // as slow as this one, so it is not exceeded again on every edit.
+    unsigned long budget = m_parseCostTimer.elapsed() * 2;
+    if (budget <= c_initParseTimeBudget) {
+        m_parseTimeBudget = c_initParseTimeBudget;
+    } else if (m_parseTimeBudget != 0) {
+        m_parseTimeBudget = qMin(budget, c_maxParseTimeBudget);
+    } else if (budget < c_maxParseTimeBudget) {
+        m_parseTimeBudget = budget;
+    }
+
+    if (p_result.m_fullParse) {
+        blockHighlights = p_result.m_blocksHighlights;
+        qDebug() << "highlighter: highlights take" << getHighlightMemoryUsage()
+                 << "bytes, saving" << getHighlightMemorySaved() << "bytes";
+        m_commentRegions = p_result.m_commentRegions;
+        m_htmlBlockRegions = p_result.m_htmlBlockRegions;
+        m_referenceDefs = p_result.m_referenceDefs;
+    } else {
+        if (p_result.m_structureChanged) {
+            m_fullParseRequired = true;
+            parse();
+            return;
+        }
+
+        // Splice the results into blockHighlights.
+        blockHighlights.replace(p_result.m_startBlock,
+                                p_result.m_numOfOldBlocks,
+                                p_result.m_blocksHighlights);
+    }
+
+    Q_ASSERT(blockHighlights.blockCount() == document->blockCount());
+
+    m_dirtyStart = m_dirtyEnd = -1;
+    m_fullParseRequired = false;
+
+    if (!updateCodeBlocks()) {
+        if (rehighlightChangedBlocks() > 0) {
+            highlightChanged();
+        }
+    }
 
-    pmh_markdown_to_elements(content, pmh_EXT_NONE, &result);
+    m_parseDelay.recordCost(m_parseCostTimer.elapsed());
+    timer->setInterval(m_parseDelay.getDelay());
 }
 
-void HGMarkdownHighlighter::handleContentChange(int /* position */, int charsRemoved, int charsAdded)
+void HGMarkdownHighlighter::updateRegionsAfterChange(int p_position,
+                                                     int p_charsRemoved,
+                                                     int p_charsAdded)
+{
+    int delta = p_charsAdded - p_charsRemoved;
+    int removedEnd = p_position + p_charsRemoved;
+
+    // Shift the regions after the change and check if the change touches one.
+    auto shiftRegions = [this, p_position, removedEnd, delta](QVector<VCommentRegion> &p_regions) {
+        for (auto & reg : p_regions) {
+            if (reg.m_startPos >= removedEnd) {
+                reg.m_startPos += delta;
+                reg.m_endPos += delta;
+            } else if (reg.m_endPos >= p_position) {
+                m_fullParseRequired = true;
+                reg.m_endPos = qMax(reg.m_endPos + delta, reg.m_startPos);
+            }
+        }
+    };
+
+    shiftRegions(m_commentRegions);
+    shiftRegions(m_htmlBlockRegions);
+
+    // Accumulate the dirty range.
+    int addedEnd = p_position + p_charsAdded;
+    if (m_dirtyStart == -1) {
+        m_dirtyStart = p_position;
+        m_dirtyEnd = addedEnd;
+    } else {
+        if (m_dirtyEnd >= removedEnd) {
+            m_dirtyEnd += delta;
+        } else if (m_dirtyEnd > p_position) {
+            m_dirtyEnd = addedEnd;
+        }
+
+        m_dirtyStart = qMin(m_dirtyStart, p_position);
+        m_dirtyEnd = qMax(m_dirtyEnd, addedEnd);
+    }
+}
+
+void HGMarkdownHighlighter::handleContentChange(int position, int charsRemoved, int charsAdded)
 {
     if (charsRemoved == 0 && charsAdded == 0) {
         return;
     }
+
+    ++m_timeStamp;
+    updateRegionsAfterChange(position, charsRemoved, charsAdded);
+
+    // The pending lazy highlight is obsolete. It will restart after next parse.
+    m_lazyTimer->stop();
+    m_lazyBlockNum = -1;
+
+    m_parseDelay.recordInput();
+    m_completeDelay.recordInput();
+
     timer->stop();
-    timer->start();
+    timer->start(m_parseDelay.getDelay());
 }
 
 void HGMarkdownHighlighter::timerTimeout()
 {
     parse();
-    if (!updateCodeBlocks()) {
-        rehighlight();
-    }
-
-    highlightChanged();
 }
 
 void HGMarkdownHighlighter::updateHighlight()
@@ -369,61 +575,87 @@ void HGMarkdownHighlighter::updateHighlight()
     timerTimeout();
 }
 
+// Get the text of blocks [@p_startBlock, @p_endBlock].
+static QString blocksText(const QTextBlock &p_startBlock, const QTextBlock &p_endBlock)
+{
+    QString text;
+    text.reserve(p_endBlock.position() + p_endBlock.length() - 1 - p_startBlock.position());
+    for (QTextBlock block = p_startBlock; block.isValid(); block = block.next()) {
+        text += block.text();
+        if (block == p_endBlock) {
+            break;
+        }
+
+        text += QLatin1Char('\n');
+    }
+
+    return text;
+}
+
 bool HGMarkdownHighlighter::updateCodeBlocks()
 {
     if (!vconfig.getEnableCodeBlockHighlight()) {
         m_codeBlockHighlights.clear();
+        m_codeBlockCache.clear();
         return false;
     }
 
-    m_codeBlockHighlights.resize(document->blockCount());
-    for (int i = 0; i < m_codeBlockHighlights.size(); ++i) {
-        m_codeBlockHighlights[i].clear();
-    }
+    // Rebuild the highlights of all the blocks in one pass, filling in those
+    // of the code blocks found in cache.
+    m_codeBlockHighlights.clear();
 
     QList<VCodeBlock> codeBlocks;
 
-    VCodeBlock item;
-    bool inBlock = false;
-    int startLeadingSpaces = -1;
-
-    // Only handle complete codeblocks.
-    QTextBlock block = document->firstBlock();
-    while (block.isValid()) {
-        QString text = block.text();
-        if (inBlock) {
-            item.m_text = item.m_text + "\n" + text;
-            int idx = codeBlockEndExp.indexIn(text);
-            if (idx >= 0 && codeBlockEndExp.capturedTexts()[1].size() == startLeadingSpaces) {
-                // End block.
-                inBlock = false;
+    // Only keep the highlights of existing code blocks.
+    QHash<VCodeBlockKey, VBlockHighlights<HLUnitStyle> > cache;
+
+    // Only handle complete codeblocks, whose fences have been recognized by
+    // highlightCodeBlock() and tracked by the block states.
+    QTextBlock startBlock;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        int state = block.userState();
+        if (state == HighlightBlockState::CodeBlockStart) {
+            startBlock = block;
+        } else if (state == HighlightBlockState::CodeBlockEnd) {
+            // See if it is a code block inside HTML comment.
+            if (startBlock.isValid() && !isBlockInsideCommentRegion(block)) {
+                VCodeBlock item;
+                item.m_startBlock = startBlock.blockNumber();
+                item.m_startPos = startBlock.position();
                 item.m_endBlock = block.blockNumber();
+                VTextBlockData *startData = static_cast<VTextBlockData *>(startBlock.userData());
+                if (startData) {
+                    item.m_lang = startData->getCodeBlockLang();
+                }
+
+                item.m_text = blocksText(startBlock, block);
+
+                m_codeBlockHighlights.appendBlocks(item.m_startBlock
+                                                   - m_codeBlockHighlights.blockCount());
 
-                // See if it is a code block inside HTML comment.
-                if (!isBlockInsideCommentRegion(block)) {
+                VCodeBlockKey key(item);
+                auto it = m_codeBlockCache.find(key);
+                if (it != m_codeBlockCache.end()
+                    && it.value().blockCount() == item.m_endBlock - item.m_startBlock + 1) {
+                    m_codeBlockHighlights.append(it.value());
+                    cache.insert(key, it.value());
+                } else {
                     qDebug() << "add one code block in lang" << item.m_lang;
+                    m_codeBlockHighlights.appendBlocks(item.m_endBlock - item.m_startBlock + 1);
                     codeBlocks.append(item);
                 }
             }
-        } else {
-            int idx = codeBlockStartExp.indexIn(text);
-            if (idx >= 0) {
-                // Start block.
-                inBlock = true;
-                item.m_startBlock = block.blockNumber();
-                item.m_startPos = block.position();
-                item.m_text = text;
-                if (codeBlockStartExp.captureCount() == 2) {
-                    item.m_lang = codeBlockStartExp.capturedTexts()[2];
-                }
 
-                startLeadingSpaces = codeBlockStartExp.capturedTexts()[1].size();
-            }
+            startBlock = QTextBlock();
+        } else if (state != HighlightBlockState::CodeBlock) {
+            startBlock = QTextBlock();
         }
-
-        block = block.next();
     }
 
+    m_codeBlockHighlights.appendBlocks(document->blockCount()
+                                       - m_codeBlockHighlights.blockCount());
+    m_codeBlockCache = cache;
+
     m_numOfCodeBlockHighlightsToRecv = codeBlocks.size();
     if (m_numOfCodeBlockHighlightsToRecv > 0) {
         emit codeBlocksUpdated(codeBlocks);
@@ -444,62 +676,265 @@ static bool HLUnitStyleComp(const HLUnitStyle &a, const HLUnitStyle &b)
     }
 }
 
-void HGMarkdownHighlighter::setCodeBlockHighlights(const QList<HLUnitPos> &p_units)
+// Split @p_units of code block @p_block into the highlights of each line.
+static VBlockHighlights<HLUnitStyle> codeBlockLineHighlights(const VCodeBlock &p_block,
+                                                             const QList<HLUnitPos> &p_units)
 {
-    if (p_units.isEmpty()) {
-        goto exit;
+    const QString &text = p_block.m_text;
+    QVector<int> lineStarts(1, 0);
+    for (int i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n') {
+            lineStarts.append(i + 1);
+        }
     }
 
-    {
-    QVector<QVector<HLUnitStyle>> highlights(m_codeBlockHighlights.size());
-
+    int nrLines = lineStarts.size();
+    QVector<QVector<HLUnitStyle> > lines(nrLines);
     for (auto const &unit : p_units) {
-        int pos = unit.m_position;
-        int end = unit.m_position + unit.m_length;
-        int startBlockNum = document->findBlock(pos).blockNumber();
-        int endBlockNum = document->findBlock(end).blockNumber();
-
-        // Text has been changed. Abandon the obsolete parsed result.
-        if (startBlockNum == -1 || endBlockNum >= highlights.size()) {
-            goto exit;
+        int pos = unit.m_position - p_block.m_startPos;
+        int end = pos + unit.m_length;
+        if (pos < 0 || end > text.size() + 1) {
+            continue;
         }
 
-        for (int i = startBlockNum; i <= endBlockNum; ++i)
-        {
-            QTextBlock block = document->findBlockByNumber(i);
-            int blockStartPos = block.position();
+        int startLine = std::upper_bound(lineStarts.begin(), lineStarts.end(), pos)
+                        - lineStarts.begin() - 1;
+        int endLine = std::upper_bound(lineStarts.begin(), lineStarts.end(), end)
+                      - lineStarts.begin() - 1;
+        for (int i = startLine; i <= endLine; ++i) {
+            // Including the trailing new line.
+            int lineStart = lineStarts[i];
+            int lineLength = (i + 1 < nrLines ? lineStarts[i + 1] : text.size() + 1) - lineStart;
             HLUnitStyle hl;
-            hl.style = unit.m_style;
-            if (i == startBlockNum) {
-                hl.start = pos - blockStartPos;
-                hl.length = (startBlockNum == endBlockNum) ?
-                                (end - pos) : (block.length() - hl.start);
-            } else if (i == endBlockNum) {
+            hl.styleId = unit.m_styleId;
+            if (i == startLine) {
+                hl.start = pos - lineStart;
+                hl.length = (startLine == endLine) ? (end - pos) : (lineLength - hl.start);
+            } else if (i == endLine) {
                 hl.start = 0;
-                hl.length = end - blockStartPos;
+                hl.length = end - lineStart;
             } else {
                 hl.start = 0;
-                hl.length = block.length();
+                hl.length = lineLength;
             }
 
-            highlights[i].append(hl);
+            lines[i].append(hl);
         }
     }
 
     // Need to highlight in order.
-    for (int i = 0; i < highlights.size(); ++i) {
-        QVector<HLUnitStyle> &units = highlights[i];
-        if (!units.isEmpty()) {
-            std::sort(units.begin(), units.end(), HLUnitStyleComp);
-            m_codeBlockHighlights[i].append(units);
+    VBlockHighlights<HLUnitStyle> highlights;
+    for (auto & units : lines) {
+        std::sort(units.begin(), units.end(), HLUnitStyleComp);
+        highlights.appendBlocks();
+        for (auto const & unit : units) {
+            highlights.appendUnit(unit);
         }
     }
+
+    return highlights;
+}
+
+void HGMarkdownHighlighter::setCodeBlockHighlights(const VCodeBlock &p_block,
+                                                   const QList<HLUnitPos> &p_units,
+                                                   bool p_succeeded)
+{
+    // A code block without any token is cached, too.
+    if (p_succeeded) {
+        VBlockHighlights<HLUnitStyle> lines = codeBlockLineHighlights(p_block, p_units);
+        m_codeBlockCache.insert(VCodeBlockKey(p_block), lines);
+
+        // Text has been changed if the code block has moved. The result will
+        // be picked up from the cache next time.
+        QTextBlock block = document->findBlockByNumber(p_block.m_startBlock);
+        if (block.isValid() && block.position() == p_block.m_startPos) {
+            applyCodeBlockHighlights(p_block.m_startBlock, lines);
+        }
     }
 
-exit:
     --m_numOfCodeBlockHighlightsToRecv;
     if (m_numOfCodeBlockHighlightsToRecv <= 0) {
+        if (rehighlightChangedBlocks() > 0) {
+            highlightChanged();
+        }
+    }
+}
+
+void HGMarkdownHighlighter::applyCodeBlockHighlights(int p_startBlock,
+                                                     const VBlockHighlights<HLUnitStyle> &p_lines)
+{
+    int nrLines = p_lines.blockCount();
+    if (p_startBlock + nrLines <= m_codeBlockHighlights.blockCount()) {
+        m_codeBlockHighlights.replace(p_startBlock, nrLines, p_lines);
+    }
+}
+
+int HGMarkdownHighlighter::getHighlightMemoryUsage() const
+{
+    return blockHighlights.memoryUsage() + m_codeBlockHighlights.memoryUsage();
+}
+
+int HGMarkdownHighlighter::getHighlightMemorySaved() const
+{
+    return blockHighlights.nestedMemoryUsage() + m_codeBlockHighlights.nestedMemoryUsage()
+           - getHighlightMemoryUsage();
+}
+
+uint HGMarkdownHighlighter::highlightHash(const QTextBlock &p_block) const
+{
+    int blockNum = p_block.blockNumber();
+    uint hash = isBlockInsideCommentRegion(p_block) ? 1 : 0;
+    if (blockHighlights.blockCount() > blockNum) {
+        const HLUnit *end = blockHighlights.end(blockNum);
+        for (const HLUnit *unit = blockHighlights.begin(blockNum); unit != end; ++unit) {
+            hash = combineHash(hash, unit->start);
+            hash = combineHash(hash, unit->length);
+            hash = combineHash(hash, unit->styleIndex);
+        }
+    }
+
+    if (m_codeBlockHighlights.blockCount() > blockNum) {
+        const HLUnitStyle *end = m_codeBlockHighlights.end(blockNum);
+        for (const HLUnitStyle *unit = m_codeBlockHighlights.begin(blockNum); unit != end; ++unit) {
+            hash = combineHash(hash, unit->start);
+            hash = combineHash(hash, unit->length);
+            hash = combineHash(hash, unit->styleId);
+        }
+    }
+
+    return hash;
+}
+
+int HGMarkdownHighlighter::rehighlightChangedBlocks()
+{
+    if (isLargeDocument()) {
+        // Visible blocks first. The others in idle time.
+        int nrChanged = 0;
+        if (m_firstVisibleBlock > -1) {
+            nrChanged = rehighlightChangedBlocks(m_firstVisibleBlock - c_lazyHighlightMargin,
+                                                 m_lastVisibleBlock + c_lazyHighlightMargin);
+        }
+
+        m_lazyBlockNum = 0;
+        m_lazyTimer->start();
+        return nrChanged;
+    }
+
+    QVector<QTextBlock> changedBlocks;
+    for (QTextBlock block = document->begin(); block.isValid(); block = block.next()) {
+        VTextBlockData *blockData = static_cast<VTextBlockData *>(block.userData());
+        if (!blockData || blockData->getHighlightHash() != highlightHash(block)) {
+            changedBlocks.append(block);
+        }
+    }
+
+    if (changedBlocks.isEmpty()) {
+        return 0;
+    }
+
+    // State changes during a rehighlight come from the new parsing result
+    // rather than from user edits.
+    bool fullParseRequired = m_fullParseRequired;
+
+    // One pass is cheaper if most of the blocks changed.
+    if (changedBlocks.size() * 2 > document->blockCount()) {
         rehighlight();
+    } else {
+        for (auto const & block : changedBlocks) {
+            // The block may have been rehighlighted following a previous one
+            // whose state changed.
+            rehighlightBlockIfChanged(block);
+        }
+    }
+
+    m_fullParseRequired = fullParseRequired;
+
+    qDebug() << "highlighter: rehighlight" << changedBlocks.size() << "changed blocks";
+    return changedBlocks.size();
+}
+
+int HGMarkdownHighlighter::rehighlightChangedBlocks(int p_first, int p_last)
+{
+    bool fullParseRequired = m_fullParseRequired;
+    int nrChanged = 0;
+    QTextBlock block = document->findBlockByNumber(qMax(p_first, 0));
+    for (int i = qMax(p_first, 0); i <= p_last && block.isValid(); ++i) {
+        if (rehighlightBlockIfChanged(block)) {
+            ++nrChanged;
+        }
+
+        block = block.next();
+    }
+
+    m_fullParseRequired = fullParseRequired;
+    return nrChanged;
+}
+
+bool HGMarkdownHighlighter::rehighlightBlockIfChanged(const QTextBlock &p_block)
+{
+    VTextBlockData *blockData = static_cast<VTextBlockData *>(p_block.userData());
+    if (blockData && blockData->getHighlightHash() == highlightHash(p_block)) {
+        return false;
+    }
+
+    rehighlightBlock(p_block);
+    return true;
+}
+
+bool HGMarkdownHighlighter::isLargeDocument() const
+{
+    return document->characterCount() > vconfig.getLargeNoteSize();
+}
+
+void HGMarkdownHighlighter::lazyHighlightSlice()
+{
+    if (m_lazyBlockNum < 0) {
+        return;
+    }
+
+    bool fullParseRequired = m_fullParseRequired;
+    QElapsedTimer timer;
+    timer.start();
+    QTextBlock block = document->findBlockByNumber(m_lazyBlockNum);
+    while (block.isValid()) {
+        rehighlightBlockIfChanged(block);
+        block = block.next();
+        if (timer.elapsed() >= c_lazyHighlightSliceTime) {
+            break;
+        }
+    }
+
+    m_fullParseRequired = fullParseRequired;
+
+    if (block.isValid()) {
+        m_lazyBlockNum = block.blockNumber();
+        m_lazyTimer->start();
+    } else {
+        m_lazyBlockNum = -1;
+        qDebug() << "highlighter: lazy highlight finished";
+        highlightChanged();
+    }
+}
+
+const VAdaptiveDelay &HGMarkdownHighlighter::getParseDelay() const
+{
+    return m_parseDelay;
+}
+
+const VAdaptiveDelay &HGMarkdownHighlighter::getCompleteDelay() const
+{
+    return m_completeDelay;
+}
+
+void HGMarkdownHighlighter::setVisibleBlockRange(int p_first, int p_last)
+{
+    m_firstVisibleBlock = p_first;
+    m_lastVisibleBlock = p_last;
+
+    // Promote the newly visible blocks.
+    if (m_lazyBlockNum > -1) {
+        rehighlightChangedBlocks(p_first - c_lazyHighlightMargin,
+                                 p_last + c_lazyHighlightMargin);
     }
 }
 
@@ -512,17 +947,66 @@ bool HGMarkdownHighlighter::isBlockInsideCommentRegion(const QTextBlock &p_block
     int start = p_block.position();
     int end = start + p_block.length();
 
-    for (auto const & reg : m_commentRegions) {
-        if (reg.contains(start) && reg.contains(end)) {
-            return true;
-        }
+    // Only the first region ending at or after @start could contain it.
+    int idx = VCommentRegion::lowerBound(m_commentRegions, start);
+    if (idx < m_commentRegions.size()) {
+        const VCommentRegion &reg = m_commentRegions[idx];
+        return reg.contains(start) && reg.contains(end);
     }
 
     return false;
 }
 
+static bool regionStartLess(const VCommentRegion &p_a, const VCommentRegion &p_b)
+{
+    return p_a.m_startPos < p_b.m_startPos;
+}
+
+void VCommentRegion::sortAndMerge(QVector<VCommentRegion> &p_regions)
+{
+    if (p_regions.size() < 2) {
+        return;
+    }
+
+    std::sort(p_regions.begin(), p_regions.end(), regionStartLess);
+
+    int last = 0;
+    for (int i = 1; i < p_regions.size(); ++i) {
+        VCommentRegion &lastReg = p_regions[last];
+        const VCommentRegion &reg = p_regions[i];
+        if (reg.m_startPos <= lastReg.m_endPos) {
+            lastReg.m_endPos = qMax(lastReg.m_endPos, reg.m_endPos);
+        } else {
+            p_regions[++last] = reg;
+        }
+    }
+
+    p_regions.resize(last + 1);
+}
+
+static bool regionEndLess(const VCommentRegion &p_reg, int p_pos)
+{
+    return p_reg.m_endPos < p_pos;
+}
+
+int VCommentRegion::lowerBound(const QVector<VCommentRegion> &p_regions, int p_pos)
+{
+    // The end positions are sorted, too.
+    return std::lower_bound(p_regions.begin(), p_regions.end(), p_pos, regionEndLess)
+           - p_regions.begin();
+}
+
 void HGMarkdownHighlighter::highlightChanged()
 {
     m_completeTimer->stop();
-    m_completeTimer->start();
+    m_completeTimer->start(m_completeDelay.getDelay());
+}
+
+void HGMarkdownHighlighter::completeTimerTimeout()
+{
+    // The receivers, such as the outline, run synchronously.
+    QElapsedTimer costTimer;
+    costTimer.start();
+    emit highlightCompleted();
+    m_completeDelay.recordCost(costTimer.elapsed());
 }
@@ -3,11 +3,13 @@
 
 #include <QTextCharFormat>
 #include <QSyntaxHighlighter>
-#include <QAtomicInt>
 #include <QSet>
 #include <QList>
 #include <QString>
 #include <QHash>
+#include "vblockhighlights.h"
+#include "vformatrunbuilder.h"
+#include "vadaptivedelay.h"
 
 extern "C" {
 #include <pmh_parser.h>
@@ -17,12 +19,27 @@ QT_BEGIN_NAMESPACE
 class QTextDocument;
 QT_END_NAMESPACE
 
+class VPegParser;
+struct VPegParseConfig;
+struct VPegParseResult;
+
 struct HighlightingStyle
 {
     pmh_element_type type;
     QTextCharFormat format;
 };
 
+// Formats of the code block styles indexed by their interned style ids.
+struct HLCodeBlockFormats
+{
+    // Format of each style id. Empty for ids not defined in current style.
+    QVector<QTextCharFormat> m_formats;
+
+    // m_mergedFormats[outer * m_formats.size() + inner] is the format of a
+    // unit of style @inner nested in a unit of style @outer.
+    QVector<QTextCharFormat> m_mergedFormats;
+};
+
 enum HighlightBlockState
 {
     Normal = 0,
@@ -43,16 +60,18 @@ struct HLUnit
 {
     // Highlight offset @start and @length with style HighlightingStyles[styleIndex]
     // within a QTextBlock
-    unsigned long start;
-    unsigned long length;
-    unsigned int styleIndex;
+    quint32 start;
+    quint32 length;
+    quint16 styleIndex;
 };
 
 struct HLUnitStyle
 {
-    unsigned long start;
-    unsigned long length;
-    QString style;
+    quint32 start;
+    quint32 length;
+
+    // Interned id of the code block style.
+    quint16 styleId;
 };
 
 // Fenced code block only.
@@ -66,21 +85,47 @@ struct VCodeBlock
     QString m_text;
 };
 
-// Highlight unit with global position and string style name.
+// Key of a fenced code block in the cache of highlights. Blocks of the same
+// language and text share the highlights.
+struct VCodeBlockKey
+{
+    explicit VCodeBlockKey(const VCodeBlock &p_block)
+        : m_lang(p_block.m_lang), m_text(p_block.m_text)
+    {
+    }
+
+    bool operator==(const VCodeBlockKey &p_other) const
+    {
+        return m_lang == p_other.m_lang && m_text == p_other.m_text;
+    }
+
+    QString m_lang;
+
+    QString m_text;
+};
+
+inline uint qHash(const VCodeBlockKey &p_key, uint p_seed = 0)
+{
+    return qHash(p_key.m_text, qHash(p_key.m_lang, p_seed));
+}
+
+// Highlight unit of a code block with global position and interned style id.
 struct HLUnitPos
 {
-    HLUnitPos() : m_position(-1), m_length(-1)
+    HLUnitPos() : m_position(-1), m_length(-1), m_styleId(0)
     {
     }
 
-    HLUnitPos(int p_position, int p_length, const QString &p_style)
-        : m_position(p_position), m_length(p_length), m_style(p_style)
+    HLUnitPos(int p_position, int p_length, quint16 p_styleId)
+        : m_position(p_position), m_length(p_length), m_styleId(p_styleId)
     {
     }
 
     int m_position;
     int m_length;
-    QString m_style;
+
+    // Interned id of the code block style.
+    quint16 m_styleId;
 };
 
 // HTML comment.
@@ -101,6 +146,20 @@ struct VCommentRegion
     {
         return m_startPos <= p_pos && m_endPos >= p_pos;
     }
+
+    // Whether this region intersects with [@p_start, @p_end].
+    bool intersect(int p_start, int p_end) const
+    {
+        return m_startPos <= p_end && m_endPos >= p_start;
+    }
+
+    // Sort @p_regions by start position and merge the overlapping ones, so
+    // that they could be searched by binary search.
+    static void sortAndMerge(QVector<VCommentRegion> &p_regions);
+
+    // Return the index of the first region in sorted and non-overlapping
+    // @p_regions which ends at or after @p_pos, or p_regions.size() if none.
+    static int lowerBound(const QVector<VCommentRegion> &p_regions, int p_pos);
 };
 
 class HGMarkdownHighlighter : public QSyntaxHighlighter
@@ -109,17 +168,40 @@ class HGMarkdownHighlighter : public QSyntaxHighlighter
 
 public:
     HGMarkdownHighlighter(const QVector<HighlightingStyle> &styles,
-                          const QHash<QString, QTextCharFormat> &codeBlockStyles,
-                          int waitInterval,
+                          const HLCodeBlockFormats &p_codeBlockFormats,
                           QTextDocument *parent = 0);
     ~HGMarkdownHighlighter();
-    // Request to update highlihgt (re-parse and re-highlight)
-    void setCodeBlockHighlights(const QList<HLUnitPos> &p_units);
+    // Highlights @p_units of code block @p_block. @p_succeeded is false if
+    // highlighting failed, in which case it will be retried next time.
+    // Otherwise the units are cached, even if there is none.
+    void setCodeBlockHighlights(const VCodeBlock &p_block, const QList<HLUnitPos> &p_units,
+                                bool p_succeeded);
+
+    // Bytes taken by the highlight units of all the blocks.
+    int getHighlightMemoryUsage() const;
+
+    // Bytes saved by the contiguous storage of the highlight units compared
+    // to a vector of units per block.
+    int getHighlightMemorySaved() const;
+
+    // Blocks [@p_first, @p_last] are visible in the viewport. For a large
+    // document, they will be highlighted before the others.
+    void setVisibleBlockRange(int p_first, int p_last);
+
+    // Delay before parsing after a change.
+    const VAdaptiveDelay &getParseDelay() const;
+
+    // Delay before signaling highlightCompleted() after a highlight change.
+    const VAdaptiveDelay &getCompleteDelay() const;
 
 signals:
     void highlightCompleted();
     void codeBlocksUpdated(const QList<VCodeBlock> &p_codeBlocks);
 
+    // The fenced code block or HTML comment state of a block has changed,
+    // which may affect the following blocks.
+    void blockStatesChanged();
+
 protected:
     void highlightBlock(const QString &text) Q_DECL_OVERRIDE;
 
@@ -130,6 +212,12 @@ private slots:
     void handleContentChange(int position, int charsRemoved, int charsAdded);
     void timerTimeout();
 
+    // Signal highlightCompleted() and measure the cost of its receivers.
+    void completeTimerTimeout();
+
+    // Rehighlight the changed blocks from m_lazyBlockNum for a while.
+    void lazyHighlightSlice();
+
 private:
     QRegExp codeBlockStartExp;
     QRegExp codeBlockEndExp;
@@ -139,54 +227,154 @@ private:
 
     QTextDocument *document;
     QVector<HighlightingStyle> highlightingStyles;
-    QHash<QString, QTextCharFormat> m_codeBlockStyles;
-    QVector<QVector<HLUnit> > blockHighlights;
+    HLCodeBlockFormats m_codeBlockFormats;
+    VBlockHighlights<HLUnit> blockHighlights;
 
     // Use another member to store the codeblocks highlights, because the highlight
     // sequence is blockHighlights, regular-expression-based highlihgts, and then
     // codeBlockHighlights.
     // Support fenced code block only.
-    QVector<QVector<HLUnitStyle> > m_codeBlockHighlights;
+    // Rebuilt in place after each parse.
+    VBlockHighlights<HLUnitStyle> m_codeBlockHighlights;
+
+    // Highlights of each line of the fenced code blocks in the document,
+    // keyed by their language and text. Code blocks found here will not be
+    // highlighted again, nor sent to VCodeBlockHighlightHelper, whose cache
+    // shared across documents holds the units by code block instead of lines.
+    QHash<VCodeBlockKey, VBlockHighlights<HLUnitStyle> > m_codeBlockCache;
 
     int m_numOfCodeBlockHighlightsToRecv;
 
-    // All HTML comment regions.
+    // Collect the formats of current block to apply them as runs.
+    VFormatRunBuilder m_runBuilder;
+
+    // All HTML comment regions, sorted and non-overlapping.
     QVector<VCommentRegion> m_commentRegions;
 
+    // All HTML block regions, sorted and non-overlapping. They may span blank
+    // lines so an incremental parse could not handle changes within them.
+    QVector<VCommentRegion> m_htmlBlockRegions;
+
+    // Text of all the reference definitions from last full parse.
+    // It will be appended to the text of an incremental parse to resolve
+    // reference links.
+    QString m_referenceDefs;
+
+    // The range [m_dirtyStart, m_dirtyEnd] of the document changed since
+    // last parse. -1 if there is no pending change.
+    int m_dirtyStart;
+    int m_dirtyEnd;
+
+    // Set when a change crosses a structural boundary (fenced code block
+    // or HTML comment), which requires a full parse.
+    bool m_fullParseRequired;
+
     // Timer to signal highlightCompleted().
     QTimer *m_completeTimer;
 
-    QAtomicInt parsing;
+    // Revision of the document, increased on each change.
+    int m_timeStamp;
+
+    // Parse the document on a worker thread.
+    VPegParser *m_parser;
+
+    // Time budget in ms of one parse. Doubled each time a parse exceeds it,
+    // up to c_maxParseTimeBudget, beyond which there is no limit. After a
+    // successful parse, it is reset to twice the cost of that parse, but no
+    // less than c_initParseTimeBudget, so it is back to normal once the
+    // document parses fast again.
+    unsigned long m_parseTimeBudget;
+
+    static const unsigned long c_initParseTimeBudget;
+    static const unsigned long c_maxParseTimeBudget;
+
+    // Range of blocks visible in the viewport. -1 if unknown.
+    int m_firstVisibleBlock;
+    int m_lastVisibleBlock;
+
+    // For a large document, the changed blocks other than the visible ones
+    // are rehighlighted in idle-time slices, from m_lazyBlockNum.
+    // -1 if there is no pending lazy highlight.
+    int m_lazyBlockNum;
+    QTimer *m_lazyTimer;
+
+    // Number of blocks around the visible ones to highlight eagerly.
+    static const int c_lazyHighlightMargin;
+
+    // Time in ms of a lazy highlight slice.
+    static const int c_lazyHighlightSliceTime;
+
     QTimer *timer;
-    int waitInterval;
 
-    char *content;
-    int capacity;
-    pmh_element **result;
+    // Adapt the interval of timer to the cost of parsing and applying the
+    // result, measured by m_parseCostTimer from the snapshot on.
+    VAdaptiveDelay m_parseDelay;
+    QElapsedTimer m_parseCostTimer;
 
-    static const int initCapacity;
+    // Adapt the interval of m_completeTimer to the cost of its receivers.
+    VAdaptiveDelay m_completeDelay;
 
-    void resizeBuffer(int newCap);
     void highlightCodeBlock(const QString &text);
     void highlightLinkWithSpacesInURL(const QString &p_text);
+
+    // Take a snapshot of the document and parse it asynchronously.
     void parse();
-    void parseInternal();
-    void initBlockHighlightFromResult(int nrBlocks);
-    void initBlockHighlihgtOne(unsigned long pos, unsigned long end,
-                               int styleIndex);
 
-    // Return true if there are fenced code blocks and it will call rehighlight() later.
+    // Commit the result if the document has not been changed since the
+    // snapshot was taken.
+    void handleParseResult(const VPegParseResult &p_result);
+
+    // Prepare a parse of the whole document.
+    void prepareFullParse(VPegParseConfig &p_config);
+
+    // Prepare a parse of only the top-level markdown blocks affected by the
+    // changes since last parse, whose results will be spliced into blockHighlights.
+    // Return false if it is not possible and a full parse is needed.
+    bool prepareIncrementalParse(VPegParseConfig &p_config);
+
+    // Update m_commentRegions, m_htmlBlockRegions and m_dirtyStart/m_dirtyEnd
+    // according to the change.
+    void updateRegionsAfterChange(int p_position, int p_charsRemoved, int p_charsAdded);
+
+    // Expand [@p_startBlock, @p_endBlock] to the boundaries of top-level
+    // markdown blocks, which are blank lines followed by a non-indented line.
+    void expandToTopLevelBlocks(QTextBlock &p_startBlock, QTextBlock &p_endBlock) const;
+
+    // Collect the complete fenced code blocks from the block states and
+    // request highlights of those not in m_codeBlockCache.
+    // Return true if there are such code blocks and it will rehighlight later.
     // Return false if there is none.
     bool updateCodeBlocks();
 
-    // Fetch all the HTML comment regions from parsing result.
-    void initHtmlCommentRegionsFromResult();
+    // Set the highlights of each line of the code block starting at block
+    // @p_startBlock.
+    void applyCodeBlockHighlights(int p_startBlock,
+                                  const VBlockHighlights<HLUnitStyle> &p_lines);
 
     // Whether @p_block is totally inside a HTML comment.
     bool isBlockInsideCommentRegion(const QTextBlock &p_block) const;
 
     // Highlights have been changed. Try to signal highlightCompleted().
     void highlightChanged();
+
+    // Hash of the highlights of @p_block from the parse results, including
+    // the code block highlights and whether it is inside a comment.
+    uint highlightHash(const QTextBlock &p_block) const;
+
+    // Rehighlight only the blocks whose highlights differ from those they
+    // were formatted with, without affecting m_fullParseRequired.
+    // For a large document, only the visible blocks are rehighlighted now.
+    // Return the number of blocks rehighlighted.
+    int rehighlightChangedBlocks();
+
+    // Rehighlight the changed blocks within [@p_first, @p_last].
+    int rehighlightChangedBlocks(int p_first, int p_last);
+
+    // Rehighlight @p_block if it is changed. Return true if it is.
+    bool rehighlightBlockIfChanged(const QTextBlock &p_block);
+
+    // Whether the document should be highlighted lazily.
+    bool isLargeDocument() const;
 };
 
 #endif
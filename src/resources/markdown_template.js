@@ -41,7 +41,8 @@ new QWebChannel(qt.webChannelTransport,
         content.requestScrollToAnchor.connect(scrollToAnchor);
 
         if (typeof highlightText == "function") {
-            content.requestHighlightText.connect(highlightText);
+            content.requestHighlightText.connect(highlightTextWithOffsets);
+            content.requestHighlightTextBatch.connect(highlightTextBatch);
             content.noticeReadyToHighlightText();
         }
     });
@@ -401,6 +402,88 @@ var insertImageCaption = function() {
     }
 }
 
+// Highlight the fenced code block @text with highlight.js.
+// Return the highlighted ranges as {units, classes}, where units is a flat
+// array of [offset, length, classId] triples with offsets relative to @text,
+// and classId indexes into classes.
+// Return null if it could not be highlighted this way.
+var highlightTextToOffsets = function(text) {
+    var firstLineEnd = text.indexOf('\n');
+    var lastLineStart = text.lastIndexOf('\n');
+    if (typeof hljs == "undefined" || firstLineEnd == -1 || lastLineStart <= firstLineEnd) {
+        return null;
+    }
+
+    var lang = text.substring(0, firstLineEnd).replace(/^\s*```/, '').trim().split(/\s+/)[0];
+    var code = text.substring(firstLineEnd + 1, lastLineStart);
+    var html;
+    if (lang && hljs.getLanguage(lang)) {
+        html = hljs.highlight(lang, code, true).value;
+    } else {
+        html = hljs.highlightAuto(code).value;
+    }
+
+    var container = document.createElement('div');
+    container.innerHTML = html;
+
+    var units = [];
+    var classes = [];
+    var classIds = {};
+    var offset = firstLineEnd + 1;
+    var walk = function(node) {
+        for (var child = node.firstChild; child; child = child.nextSibling) {
+            if (child.nodeType == Node.TEXT_NODE) {
+                offset += child.nodeValue.length;
+            } else if (child.nodeType == Node.ELEMENT_NODE) {
+                var start = offset;
+                walk(child);
+                var cls = child.className;
+                if (cls && offset > start) {
+                    if (!classIds.hasOwnProperty(cls)) {
+                        classIds[cls] = classes.length;
+                        classes.push(cls);
+                    }
+
+                    units.push(start, offset - start, classIds[cls]);
+                }
+            }
+        }
+    };
+
+    walk(container);
+    return { units: units, classes: classes };
+};
+
+// Return the highlighted ranges via highlightTextCB2().
+// Fall back to highlightText() which returns the HTML.
+var highlightTextWithOffsets = function(text, id, timeStamp) {
+    var res = highlightTextToOffsets(text);
+    if (res) {
+        content.highlightTextCB2(res.units, res.classes, id, timeStamp);
+    } else {
+        highlightText(text, id, timeStamp);
+    }
+};
+
+// Highlight all the code blocks of one request and return the results of
+// highlightTextToOffsets() together in one highlightTextBatchCB() as
+// {id, units, classes}. Those falling back to highlightText() are returned
+// one by one.
+var highlightTextBatch = function(texts, ids, timeStamp) {
+    var results = [];
+    for (var i = 0; i < texts.length; ++i) {
+        var res = highlightTextToOffsets(texts[i]);
+        if (res) {
+            res.id = ids[i];
+            results.push(res);
+        } else {
+            highlightText(texts[i], ids[i], timeStamp);
+        }
+    }
+
+    content.highlightTextBatchCB(results, timeStamp);
+};
+
 // The renderer specific code should call this function once thay have finished
 // markdown-specifi handle logics, such as Mermaid, MathJax.
 var finishLogics = function() {
@@ -70,7 +70,14 @@ SOURCES += main.cpp\
     vvimindicator.cpp \
     vbuttonwithwidget.cpp \
     vtabindicator.cpp \
-    dialog/vupdater.cpp
+    dialog/vupdater.cpp \
+    vpegparser.cpp \
+    vcodeblocktokenizer.cpp \
+    vformatrunbuilder.cpp \
+    vadaptivedelay.cpp \
+    vimagedecoder.cpp \
+    vimagecache.cpp \
+    vthumbnailcache.cpp
 
 HEADERS  += vmainwindow.h \
     vdirectorytree.h \
@@ -128,7 +135,16 @@ HEADERS  += vmainwindow.h \
     vbuttonwithwidget.h \
     vedittabinfo.h \
     vtabindicator.h \
-    dialog/vupdater.h
+    dialog/vupdater.h \
+    vpegparser.h \
+    vcodeblocktokenizer.h \
+    vtextblockdata.h \
+    vblockhighlights.h \
+    vformatrunbuilder.h \
+    vadaptivedelay.h \
+    vimagedecoder.h \
+    vimagecache.h \
+    vthumbnailcache.h
 
 RESOURCES += \
     vnote.qrc \
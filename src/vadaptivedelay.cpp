@@ -0,0 +1,70 @@
+#include "vadaptivedelay.h"
+
+#include <QtGlobal>
+
+// Weight of a new sample in the moving averages.
+static const double c_sampleWeight = 0.3;
+
+// Wait at least this many times the cost of the work, so that it takes a
+// bounded share of the time.
+static const double c_costFactor = 2;
+
+// When the work is not cheap compared to the typing interval, wait this many
+// times the interval so that it does not run in the middle of a burst.
+static const double c_cadenceFactor = 1.5;
+
+// The work is cheap if it costs less than this share of the typing interval.
+static const double c_cheapRatio = 0.25;
+
+// A gap longer than this many times the max delay ends a burst of typing and
+// is not a sample of the interval.
+static const int c_burstGapFactor = 2;
+
+static inline double movingAverage(double p_average, double p_sample)
+{
+    if (p_average < 0) {
+        return p_sample;
+    }
+
+    return p_average + c_sampleWeight * (p_sample - p_average);
+}
+
+VAdaptiveDelay::VAdaptiveDelay(int p_minDelay, int p_maxDelay)
+    : m_minDelay(qMax(p_minDelay, 0)), m_maxDelay(qMax(p_maxDelay, p_minDelay)),
+      m_delay(m_minDelay), m_averageCost(-1), m_typingInterval(-1)
+{
+}
+
+void VAdaptiveDelay::recordInput()
+{
+    if (m_inputTimer.isValid()) {
+        qint64 gap = m_inputTimer.elapsed();
+        if (gap <= c_burstGapFactor * m_maxDelay) {
+            m_typingInterval = movingAverage(m_typingInterval, gap);
+            updateDelay();
+        }
+    }
+
+    m_inputTimer.start();
+}
+
+void VAdaptiveDelay::recordCost(qint64 p_cost)
+{
+    m_averageCost = movingAverage(m_averageCost, qMax(p_cost, (qint64)0));
+    updateDelay();
+}
+
+void VAdaptiveDelay::updateDelay()
+{
+    double delay = m_minDelay;
+    if (m_averageCost >= 0) {
+        delay = qMax(delay, c_costFactor * m_averageCost);
+
+        if (m_typingInterval >= 0
+            && m_averageCost > c_cheapRatio * m_typingInterval) {
+            delay = qMax(delay, c_cadenceFactor * m_typingInterval);
+        }
+    }
+
+    m_delay = qBound(m_minDelay, qRound(delay), m_maxDelay);
+}
@@ -0,0 +1,73 @@
+#ifndef VADAPTIVEDELAY_H
+#define VADAPTIVEDELAY_H
+
+#include <QElapsedTimer>
+
+// Pick the delay of a debounce timer from the cost of the work it triggers
+// and the typing cadence of the user, within [min, max]. Cheap work runs
+// soon after a change, while expensive work waits for a pause in typing.
+class VAdaptiveDelay
+{
+public:
+    VAdaptiveDelay(int p_minDelay, int p_maxDelay);
+
+    // Record an input, such as a change of the document.
+    void recordInput();
+
+    // Record that one run of the work took @p_cost ms.
+    void recordCost(qint64 p_cost);
+
+    // Current delay in ms.
+    int getDelay() const;
+
+    // Average cost in ms of the work. -1 if unknown.
+    int getAverageCost() const;
+
+    // Average interval in ms between inputs within a burst. -1 if unknown.
+    int getTypingInterval() const;
+
+    int getMinDelay() const;
+
+    int getMaxDelay() const;
+
+private:
+    void updateDelay();
+
+    int m_minDelay;
+    int m_maxDelay;
+    int m_delay;
+
+    // Exponential moving averages in ms. Negative if there is no sample.
+    double m_averageCost;
+    double m_typingInterval;
+
+    // Time since last input. Invalid before the first one.
+    QElapsedTimer m_inputTimer;
+};
+
+inline int VAdaptiveDelay::getDelay() const
+{
+    return m_delay;
+}
+
+inline int VAdaptiveDelay::getAverageCost() const
+{
+    return m_averageCost < 0 ? -1 : qRound(m_averageCost);
+}
+
+inline int VAdaptiveDelay::getTypingInterval() const
+{
+    return m_typingInterval < 0 ? -1 : qRound(m_typingInterval);
+}
+
+inline int VAdaptiveDelay::getMinDelay() const
+{
+    return m_minDelay;
+}
+
+inline int VAdaptiveDelay::getMaxDelay() const
+{
+    return m_maxDelay;
+}
+
+#endif // VADAPTIVEDELAY_H
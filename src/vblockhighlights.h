@@ -0,0 +1,179 @@
+#ifndef VBLOCKHIGHLIGHTS_H
+#define VBLOCKHIGHLIGHTS_H
+
+#include <QVector>
+#include <QtGlobal>
+#include <algorithm>
+
+// Highlight units of a sequence of blocks in one contiguous array, with a
+// table of the index of the first unit of each block.
+// Rebuilding it keeps the capacity, so it does not allocate in steady state.
+template <typename T>
+class VBlockHighlights
+{
+public:
+    VBlockHighlights() : m_offsets(1, 0)
+    {
+    }
+
+    int blockCount() const
+    {
+        return m_offsets.size() - 1;
+    }
+
+    int unitCount() const
+    {
+        return m_units.size();
+    }
+
+    // Units of block @p_block are [begin(@p_block), end(@p_block)).
+    const T *begin(int p_block) const
+    {
+        return m_units.constData() + m_offsets[p_block];
+    }
+
+    const T *end(int p_block) const
+    {
+        return m_units.constData() + m_offsets[p_block + 1];
+    }
+
+    T *begin(int p_block)
+    {
+        return m_units.data() + m_offsets[p_block];
+    }
+
+    T *end(int p_block)
+    {
+        return m_units.data() + m_offsets[p_block + 1];
+    }
+
+    // Remove all the blocks but keep the capacity.
+    void clear()
+    {
+        m_units.resize(0);
+        m_offsets.resize(1);
+    }
+
+    void reserve(int p_nrBlocks, int p_nrUnits)
+    {
+        m_offsets.reserve(p_nrBlocks + 1);
+        m_units.reserve(p_nrUnits);
+    }
+
+    // Append @p_nr blocks without units.
+    void appendBlocks(int p_nr = 1)
+    {
+        if (p_nr > 0) {
+            m_offsets.insert(m_offsets.size(), p_nr, m_units.size());
+        }
+    }
+
+    // Append @p_unit to the last block.
+    void appendUnit(const T &p_unit)
+    {
+        Q_ASSERT(blockCount() > 0);
+        m_units.append(p_unit);
+        m_offsets.last() = m_units.size();
+    }
+
+    // Append all the blocks of @p_other.
+    void append(const VBlockHighlights &p_other)
+    {
+        int base = m_units.size();
+        m_units += p_other.m_units;
+        for (int i = 1; i < p_other.m_offsets.size(); ++i) {
+            m_offsets.append(base + p_other.m_offsets[i]);
+        }
+    }
+
+    // Re-layout as blocks with @p_counts[i] units each. The content of the
+    // units is undefined and should be filled via begin().
+    void setUnitCounts(const QVector<int> &p_counts)
+    {
+        m_offsets.resize(p_counts.size() + 1);
+        int total = 0;
+        for (int i = 0; i < p_counts.size(); ++i) {
+            m_offsets[i] = total;
+            total += p_counts[i];
+        }
+
+        m_offsets.last() = total;
+        m_units.resize(total);
+    }
+
+    // Replace @p_count blocks from block @p_start with all the blocks of
+    // @p_other in place.
+    void replace(int p_start, int p_count, const VBlockHighlights &p_other)
+    {
+        Q_ASSERT(p_start >= 0 && p_count >= 0 && p_start + p_count <= blockCount());
+        int unitStart = m_offsets[p_start];
+        int nrRemovedUnits = m_offsets[p_start + p_count] - unitStart;
+        int unitDelta = p_other.unitCount() - nrRemovedUnits;
+        splice(m_units, unitStart, nrRemovedUnits,
+               p_other.m_units.constData(), p_other.unitCount());
+
+        // Entry i + 1 is the end of block i.
+        int nrNewBlocks = p_other.blockCount();
+        splice(m_offsets, p_start + 1, p_count,
+               p_other.m_offsets.constData() + 1, nrNewBlocks);
+        int i = p_start + 1;
+        for (; i < p_start + 1 + nrNewBlocks; ++i) {
+            m_offsets[i] += unitStart;
+        }
+
+        for (; i < m_offsets.size(); ++i) {
+            m_offsets[i] += unitDelta;
+        }
+    }
+
+    // Bytes allocated.
+    int memoryUsage() const
+    {
+        return m_units.capacity() * sizeof(T) + m_offsets.capacity() * sizeof(int);
+    }
+
+    // Bytes the same units would take with a QVector per block and units of
+    // two unsigned long and a pointer-sized style.
+    int nestedMemoryUsage() const
+    {
+        const int nestedUnitSize = 2 * sizeof(unsigned long) + sizeof(void *);
+        int bytes = blockCount() * sizeof(QVector<T>);
+        for (int i = 0; i < blockCount(); ++i) {
+            if (m_offsets[i + 1] > m_offsets[i]) {
+                bytes += sizeof(QArrayData) + (m_offsets[i + 1] - m_offsets[i]) * nestedUnitSize;
+            }
+        }
+
+        return bytes;
+    }
+
+private:
+    // Replace @p_nrRemoved elements from @p_pos of @p_vec with @p_nrInserted
+    // elements from @p_src, shifting the tail in place.
+    template <typename U>
+    static void splice(QVector<U> &p_vec, int p_pos, int p_nrRemoved,
+                       const U *p_src, int p_nrInserted)
+    {
+        int oldSize = p_vec.size();
+        int delta = p_nrInserted - p_nrRemoved;
+        if (delta > 0) {
+            p_vec.resize(oldSize + delta);
+            U *data = p_vec.data();
+            std::move_backward(data + p_pos + p_nrRemoved, data + oldSize, data + oldSize + delta);
+        } else if (delta < 0) {
+            U *data = p_vec.data();
+            std::move(data + p_pos + p_nrRemoved, data + oldSize, data + p_pos + p_nrInserted);
+            p_vec.resize(oldSize + delta);
+        }
+
+        std::copy(p_src, p_src + p_nrInserted, p_vec.data() + p_pos);
+    }
+
+    QVector<T> m_units;
+
+    // m_offsets[i] is the index in @m_units of the first unit of block i.
+    // The last entry is the number of units.
+    QVector<int> m_offsets;
+};
+
+#endif // VBLOCKHIGHLIGHTS_H
@@ -2,19 +2,38 @@
 
 #include <QDebug>
 #include <QStringList>
+#include <QJsonObject>
 #include "vdocument.h"
 #include "utils/vutils.h"
 
+extern VConfigManager vconfig;
+
+const int VCodeBlockHighlightHelper::c_maxCacheCost = 200000;
+
+QCache<VCodeBlockCacheKey, QList<HLUnitPos> > VCodeBlockHighlightHelper::s_cache(c_maxCacheCost);
+
+int VCodeBlockHighlightHelper::s_numOfCacheHits = 0;
+
+int VCodeBlockHighlightHelper::s_numOfCacheMisses = 0;
+
 VCodeBlockHighlightHelper::VCodeBlockHighlightHelper(HGMarkdownHighlighter *p_highlighter,
                                                      VDocument *p_vdoc,
                                                      MarkdownConverterType p_type)
     : QObject(p_highlighter), m_highlighter(p_highlighter), m_vdocument(p_vdoc),
       m_type(p_type), m_timeStamp(0)
 {
+    m_tokenizer = new VCodeBlockTokenizer(this);
+    connect(m_tokenizer, &VCodeBlockTokenizer::tokenized,
+            this, &VCodeBlockHighlightHelper::handleTokenizeResult);
+
     connect(m_highlighter, &HGMarkdownHighlighter::codeBlocksUpdated,
             this, &VCodeBlockHighlightHelper::handleCodeBlocksUpdated);
     connect(m_vdocument, &VDocument::textHighlighted,
             this, &VCodeBlockHighlightHelper::handleTextHighlightResult);
+    connect(m_vdocument, &VDocument::textHighlightedOffsets,
+            this, &VCodeBlockHighlightHelper::handleTextHighlightOffsets);
+    connect(m_vdocument, &VDocument::textHighlightedBatch,
+            this, &VCodeBlockHighlightHelper::handleTextHighlightBatch);
     connect(m_vdocument, &VDocument::readyToHighlightText,
             m_highlighter, &HGMarkdownHighlighter::updateHighlight);
 }
@@ -56,9 +75,97 @@ void VCodeBlockHighlightHelper::handleCodeBlocksUpdated(const QList<VCodeBlock>
 {
     int curStamp = m_timeStamp.fetchAndAddRelaxed(1) + 1;
     m_codeBlocks = p_codeBlocks;
+
+    QList<VCodeBlock> nativeBlocks;
+    QVector<int> nativeIds;
+    QVector<int> cachedIds;
+    QStringList jsTexts;
+    QVariantList jsIds;
     for (int i = 0; i < m_codeBlocks.size(); ++i) {
-        QString unindentedText = unindentCodeBlock(m_codeBlocks[i].m_text);
-        m_vdocument->highlightTextAsync(unindentedText, i, curStamp);
+        const VCodeBlock &block = m_codeBlocks[i];
+        if (s_cache.contains(cacheKey(block))) {
+            ++s_numOfCacheHits;
+            cachedIds.append(i);
+            continue;
+        }
+
+        ++s_numOfCacheMisses;
+        if (VCodeBlockTokenizer::isLanguageSupported(block.m_lang)) {
+            nativeBlocks.append(block);
+            nativeIds.append(i);
+        } else {
+            jsTexts.append(unindentCodeBlock(block.m_text));
+            jsIds.append(i);
+        }
+    }
+
+    // Send all of them in one message.
+    if (!jsTexts.isEmpty()) {
+        m_vdocument->highlightTextBatchAsync(jsTexts, jsIds, curStamp);
+    }
+
+    if (!nativeBlocks.isEmpty()) {
+        m_tokenizer->tokenizeAsync(curStamp, nativeBlocks, nativeIds,
+                                   vconfig.getCodeBlockStyleIds());
+    }
+
+    // Re-position the cached units. This may rehighlight synchronously, so
+    // do it after all the requests are sent.
+    for (auto idx : cachedIds) {
+        const VCodeBlock &block = m_codeBlocks[idx];
+        QList<HLUnitPos> units = *s_cache.object(cacheKey(block));
+        for (auto & unit : units) {
+            unit.m_position += block.m_startPos;
+        }
+
+        m_highlighter->setCodeBlockHighlights(block, units, true);
+    }
+}
+
+VCodeBlockCacheKey VCodeBlockHighlightHelper::cacheKey(const VCodeBlock &p_block) const
+{
+    // The units are relative to the raw text, not the unindented one.
+    return VCodeBlockCacheKey(p_block, m_type);
+}
+
+void VCodeBlockHighlightHelper::setCodeBlockHighlights(const VCodeBlock &p_block,
+                                                       const QList<HLUnitPos> &p_units,
+                                                       bool p_succeeded)
+{
+    if (p_succeeded) {
+        QList<HLUnitPos> *units = new QList<HLUnitPos>(p_units);
+        for (auto & unit : *units) {
+            unit.m_position -= p_block.m_startPos;
+        }
+
+        // An empty entry still costs its key.
+        s_cache.insert(cacheKey(p_block), units, qMax(units->size(), 1));
+    }
+
+    m_highlighter->setCodeBlockHighlights(p_block, p_units, p_succeeded);
+}
+
+int VCodeBlockHighlightHelper::getNumOfCacheHits()
+{
+    return s_numOfCacheHits;
+}
+
+int VCodeBlockHighlightHelper::getNumOfCacheMisses()
+{
+    return s_numOfCacheMisses;
+}
+
+void VCodeBlockHighlightHelper::handleTokenizeResult(int p_timeStamp,
+                                                     const QVector<VCodeBlockTokens> &p_result)
+{
+    // Abandon obsolete result.
+    if (m_timeStamp.load() != p_timeStamp) {
+        return;
+    }
+
+    for (auto const & tokens : p_result) {
+        // The tokenizer does not fail. No token means plain text.
+        setCodeBlockHighlights(m_codeBlocks.at(tokens.m_id), tokens.m_units, true);
     }
 }
 
@@ -74,6 +181,122 @@ void VCodeBlockHighlightHelper::handleTextHighlightResult(const QString &p_html,
     parseHighlightResult(p_timeStamp, p_id, p_html);
 }
 
+// Return the offset in @p_text of each offset in unindentCodeBlock(@p_text),
+// including the end.
+static QVector<int> unindentedOffsetMap(const QString &p_text)
+{
+    int size = p_text.size();
+    int nrSpaces = 0;
+    while (nrSpaces < size && p_text[nrSpaces] != '\n' && p_text[nrSpaces].isSpace()) {
+        ++nrSpaces;
+    }
+
+    QVector<int> map;
+    map.reserve(size + 1);
+    int i = 0;
+    while (i <= size) {
+        // Skip the leading spaces removed from each line.
+        for (int j = 0;
+             j < nrSpaces && i < size && p_text[i] != '\n' && p_text[i].isSpace();
+             ++j) {
+            ++i;
+        }
+
+        while (i < size && p_text[i] != '\n') {
+            map.append(i++);
+        }
+
+        // The new line or the end.
+        map.append(i++);
+    }
+
+    return map;
+}
+
+void VCodeBlockHighlightHelper::handleTextHighlightOffsets(const QJsonArray &p_units,
+                                                           const QJsonArray &p_classes,
+                                                           int p_id,
+                                                           int p_timeStamp)
+{
+    // Abandon obsolete result.
+    if (m_timeStamp.load() != p_timeStamp) {
+        return;
+    }
+
+    parseHighlightOffsets(p_timeStamp, p_id, p_units, p_classes);
+}
+
+void VCodeBlockHighlightHelper::handleTextHighlightBatch(const QJsonArray &p_results,
+                                                         int p_timeStamp)
+{
+    // Abandon obsolete result.
+    if (m_timeStamp.load() != p_timeStamp) {
+        return;
+    }
+
+    for (auto const & val : p_results) {
+        QJsonObject res = val.toObject();
+        int id = res.value("id").toInt(-1);
+        if (id < 0 || id >= m_codeBlocks.size()) {
+            qWarning() << "invalid highlighted result"
+                       << "stamp:" << p_timeStamp << "index:" << id;
+            continue;
+        }
+
+        parseHighlightOffsets(p_timeStamp,
+                              id,
+                              res.value("units").toArray(),
+                              res.value("classes").toArray());
+    }
+}
+
+void VCodeBlockHighlightHelper::parseHighlightOffsets(int p_timeStamp,
+                                                      int p_idx,
+                                                      const QJsonArray &p_units,
+                                                      const QJsonArray &p_classes)
+{
+    const VCodeBlock &block = m_codeBlocks.at(p_idx);
+
+    // Style id of each class. -1 for those without a style.
+    const QHash<QString, quint16> &styleIds = vconfig.getCodeBlockStyleIds();
+    QVector<int> classStyleIds;
+    classStyleIds.reserve(p_classes.size());
+    for (auto const & cls : p_classes) {
+        auto it = styleIds.find(cls.toString());
+        classStyleIds.append(it != styleIds.end() ? it.value() : -1);
+    }
+
+    // The offsets are relative to the unindented text.
+    QVector<int> offsetMap = unindentedOffsetMap(block.m_text);
+
+    QList<HLUnitPos> hlUnits;
+    bool succeeded = true;
+    for (int i = 0; i + 2 < p_units.size(); i += 3) {
+        int offset = p_units[i].toInt();
+        int end = offset + p_units[i + 1].toInt();
+        int classId = p_units[i + 2].toInt();
+        if (offset < 0 || end < offset || end >= offsetMap.size()
+            || classId < 0 || classId >= classStyleIds.size()) {
+            qWarning() << "invalid highlighted offsets"
+                       << "stamp:" << p_timeStamp << "index:" << p_idx;
+            hlUnits.clear();
+            succeeded = false;
+            break;
+        }
+
+        int styleId = classStyleIds[classId];
+        if (styleId == -1) {
+            continue;
+        }
+
+        int pos = offsetMap[offset];
+        hlUnits.append(HLUnitPos(block.m_startPos + pos, offsetMap[end] - pos, styleId));
+    }
+
+    // We need to call this function anyway to trigger the rehighlight.
+    setCodeBlockHighlights(block, hlUnits, succeeded);
+}
+
 static void revertEscapedHtml(QString &p_html)
 {
     p_html.replace("&gt;", ">").replace("&lt;", "<").replace("&amp;", "&");
@@ -106,10 +329,33 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
                                                      const QString &p_html)
 {
     const VCodeBlock &block = m_codeBlocks.at(p_idx);
-    int startPos = block.m_startPos;
-    QString text = block.m_text;
-
     QList<HLUnitPos> hlUnits;
+    bool succeed = parseHighlightHtml(block, p_html, vconfig.getCodeBlockStyleIds(), hlUnits);
+
+    // Pass result back to highlighter.
+    int curStamp = m_timeStamp.load();
+    // Abandon obsolete result.
+    if (curStamp != p_timeStamp) {
+        return;
+    }
+
+    if (!succeed) {
+        qWarning() << "fail to parse highlighted result"
+                   << "stamp:" << p_timeStamp << "index:" << p_idx << p_html;
+        hlUnits.clear();
+    }
+
+    // We need to call this function anyway to trigger the rehighlight.
+    setCodeBlockHighlights(block, hlUnits, succeed);
+}
+
+bool VCodeBlockHighlightHelper::parseHighlightHtml(const VCodeBlock &p_block,
+                                                   const QString &p_html,
+                                                   const QHash<QString, quint16> &p_styleIds,
+                                                   QList<HLUnitPos> &p_units)
+{
+    int startPos = p_block.m_startPos;
+    const QString &text = p_block.m_text;
 
     bool failed = true;
 
@@ -119,21 +365,21 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
     // textIndex is the start index in the code block text to search for.
     int textIndex = text.indexOf('\n');
     if (textIndex == -1) {
-        goto exit;
+        return false;
     }
     ++textIndex;
 
     if (xml.readNextStartElement()) {
         if (xml.name() != "pre") {
-            goto exit;
+            return false;
         }
 
         if (!xml.readNextStartElement()) {
-            goto exit;
+            return false;
         }
 
         if (xml.name() != "code") {
-            goto exit;
+            return false;
         }
 
         while (xml.readNext()) {
@@ -146,16 +392,16 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
                 matchTokenRelaxed(text, tokenStr, textIndex, start, end);
                 if (start == -1) {
                     failed = true;
-                    goto exit;
+                    break;
                 }
             } else if (xml.isStartElement()) {
                 if (xml.name() != "span") {
                     failed = true;
-                    goto exit;
+                    break;
                 }
-                if (!parseSpanElement(xml, startPos, text, textIndex, hlUnits)) {
+                if (!parseSpanElement(xml, startPos, text, p_styleIds, textIndex, p_units)) {
                     failed = true;
-                    goto exit;
+                    break;
                 }
             } else if (xml.isEndElement()) {
                 if (xml.name() != "code" && xml.name() != "pre") {
@@ -163,35 +409,21 @@ void VCodeBlockHighlightHelper::parseHighlightResult(int p_timeStamp,
                 } else {
                     failed = false;
                 }
-                goto exit;
+                break;
             } else {
                 failed = true;
-                goto exit;
+                break;
             }
         }
     }
 
-exit:
-    // Pass result back to highlighter.
-    int curStamp = m_timeStamp.load();
-    // Abandon obsolete result.
-    if (curStamp != p_timeStamp) {
-        return;
-    }
-
-    if (xml.hasError() || failed) {
-        qWarning() << "fail to parse highlighted result"
-                   << "stamp:" << p_timeStamp << "index:" << p_idx << p_html;
-        hlUnits.clear();
-    }
-
-    // We need to call this function anyway to trigger the rehighlight.
-    m_highlighter->setCodeBlockHighlights(hlUnits);
+    return !xml.hasError() && !failed;
 }
 
 bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
                                                  int p_startPos,
                                                  const QString &p_text,
+                                                 const QHash<QString, quint16> &p_styleIds,
                                                  int &p_index,
                                                  QList<HLUnitPos> &p_units)
 {
@@ -215,7 +447,7 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
             }
 
             // Sub-span.
-            if (!parseSpanElement(p_xml, p_startPos, p_text, p_index, p_units)) {
+            if (!parseSpanElement(p_xml, p_startPos, p_text, p_styleIds, p_index, p_units)) {
                 return false;
             }
         } else if (p_xml.isEndElement()) {
@@ -223,9 +455,13 @@ bool VCodeBlockHighlightHelper::parseSpanElement(QXmlStreamReader &p_xml,
                 return false;
             }
 
-            // Got a complete span.
-            HLUnitPos unit(unitStart + p_startPos, p_index - unitStart, style);
-            p_units.append(unit);
+            // Got a complete span. Skip those without a style.
+            auto it = p_styleIds.find(style);
+            if (it != p_styleIds.end()) {
+                HLUnitPos unit(unitStart + p_startPos, p_index - unitStart, it.value());
+                p_units.append(unit);
+            }
+
             return true;
         } else {
             return false;
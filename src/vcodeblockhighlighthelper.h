@@ -4,11 +4,38 @@
 #include <QObject>
 #include <QList>
 #include <QAtomicInteger>
+#include <QCache>
+#include <QJsonArray>
 #include <QXmlStreamReader>
 #include "vconfigmanager.h"
+#include "vcodeblocktokenizer.h"
 
 class VDocument;
 
+// Key of the shared cache of code block highlights. Blocks of the same
+// language and text share the highlights under the same converter.
+struct VCodeBlockCacheKey
+{
+    VCodeBlockCacheKey(const VCodeBlock &p_block, MarkdownConverterType p_type)
+        : m_block(p_block), m_type(p_type)
+    {
+    }
+
+    bool operator==(const VCodeBlockCacheKey &p_other) const
+    {
+        return m_type == p_other.m_type && m_block == p_other.m_block;
+    }
+
+    VCodeBlockKey m_block;
+
+    MarkdownConverterType m_type;
+};
+
+inline uint qHash(const VCodeBlockCacheKey &p_key, uint p_seed = 0)
+{
+    return qHash(p_key.m_block, p_seed ^ static_cast<uint>(p_key.m_type));
+}
+
 class VCodeBlockHighlightHelper : public QObject
 {
     Q_OBJECT
@@ -16,22 +43,47 @@ public:
     VCodeBlockHighlightHelper(HGMarkdownHighlighter *p_highlighter,
                               VDocument *p_vdoc, MarkdownConverterType p_type);
 
+    // Number of code blocks whose highlights are found in the cache.
+    static int getNumOfCacheHits();
+
+    // Number of code blocks whose highlights are not found in the cache.
+    static int getNumOfCacheMisses();
+
+    // Parse @p_html, the output of highlight.js for code block @p_block, into
+    // @p_units with global positions. Spans of classes not in @p_styleIds are
+    // dropped. Return false if @p_html does not match the text of @p_block.
+    static bool parseHighlightHtml(const VCodeBlock &p_block, const QString &p_html,
+                                   const QHash<QString, quint16> &p_styleIds,
+                                   QList<HLUnitPos> &p_units);
+
 signals:
 
 private slots:
     void handleCodeBlocksUpdated(const QList<VCodeBlock> &p_codeBlocks);
     void handleTextHighlightResult(const QString &p_html, int p_id, int p_timeStamp);
+    void handleTextHighlightOffsets(const QJsonArray &p_units, const QJsonArray &p_classes,
+                                    int p_id, int p_timeStamp);
+    void handleTextHighlightBatch(const QJsonArray &p_results, int p_timeStamp);
+    void handleTokenizeResult(int p_timeStamp, const QVector<VCodeBlockTokens> &p_result);
 
 private:
     void parseHighlightResult(int p_timeStamp, int p_idx, const QString &p_html);
 
+    // @p_units: flat array of [offset, length, classId] triples relative to
+    // the unindented text of code block @p_idx;
+    // @p_classes: class names indexed by classId;
+    void parseHighlightOffsets(int p_timeStamp, int p_idx,
+                               const QJsonArray &p_units, const QJsonArray &p_classes);
+
     // @p_startPos: the global position of the start of the code block;
     // @p_text: the raw text of the code block;
+    // @p_styleIds: ids of the styles to keep;
     // @p_index: the start index of the span element within @p_text;
     // @p_units: all the highlight units of this code block;
-    bool parseSpanElement(QXmlStreamReader &p_xml, int p_startPos,
-                          const QString &p_text, int &p_index,
-                          QList<HLUnitPos> &p_units);
+    static bool parseSpanElement(QXmlStreamReader &p_xml, int p_startPos,
+                                 const QString &p_text,
+                                 const QHash<QString, quint16> &p_styleIds,
+                                 int &p_index, QList<HLUnitPos> &p_units);
     // @p_text: text of fenced code block.
     // Get the indent level of the first line (fence) and unindent the whole block
     // to make the fence at the highest indent level.
@@ -39,11 +91,39 @@ private:
     // without any context.
     QString unindentCodeBlock(const QString &p_text);
 
+    VCodeBlockCacheKey cacheKey(const VCodeBlock &p_block) const;
+
+    // Pass @p_units of @p_block to the highlighter and cache them if
+    // @p_succeeded, even if there is none.
+    void setCodeBlockHighlights(const VCodeBlock &p_block, const QList<HLUnitPos> &p_units,
+                                bool p_succeeded);
+
     HGMarkdownHighlighter *m_highlighter;
     VDocument *m_vdocument;
     MarkdownConverterType m_type;
     QAtomicInteger<int> m_timeStamp;
     QList<VCodeBlock> m_codeBlocks;
+
+    // Tokenize code blocks of supported languages in process. Others are
+    // highlighted by highlight.js in the web view.
+    VCodeBlockTokenizer *m_tokenizer;
+
+    // Highlight units of code blocks with positions relative to the code
+    // block, shared by all the helpers. The cost of each entry is its number
+    // of units.
+    // The highlighter keeps the per-line highlights of the code blocks of its
+    // own document, so an unchanged document does not even signal its code
+    // blocks. This cache serves the code blocks new to a document, such as
+    // those of another note, a reopened note or a block edited back, without
+    // a round trip to highlight.js or the tokenizer.
+    static QCache<VCodeBlockCacheKey, QList<HLUnitPos> > s_cache;
+
+    static int s_numOfCacheHits;
+
+    static int s_numOfCacheMisses;
+
+    // Max number of units in the cache.
+    static const int c_maxCacheCost;
 };
 
 #endif // VCODEBLOCKHIGHLIGHTHELPER_H
@@ -0,0 +1,638 @@
+#include "vcodeblocktokenizer.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+enum LexerFlag
+{
+    // '#' to the end of line.
+    HashComment = 0x1,
+    // "//" to the end of line.
+    SlashComment = 0x2,
+    // "/* */".
+    BlockComment = 0x4,
+    // "--" to the end of line.
+    DashComment = 0x8,
+    // '#' at the start of a line begins a preprocessor directive.
+    Preprocessor = 0x10,
+    // Single-quoted strings.
+    SingleQuoteString = 0x20,
+    // Python's """ and ''' strings.
+    TripleQuoteString = 0x40,
+    // `...` strings, which may span lines.
+    BacktickString = 0x80,
+    // Quoted strings may span lines.
+    MultiLineString = 0x100,
+    // $var, ${var} and $1.
+    DollarVariable = 0x200,
+    // '$' is part of identifiers.
+    DollarIdentifier = 0x400,
+    // @decorator.
+    Decorator = 0x800,
+    // A string followed by ':' is a key.
+    StringKey = 0x1000,
+    // A line in the form of "key:" or "- key:".
+    YamlKey = 0x2000,
+    // Keywords are case insensitive.
+    CaseInsensitive = 0x4000
+};
+
+// Classes of tokens, named after those of highlight.js.
+enum TokenClass
+{
+    TokenKeyword = 0,
+    TokenBuiltIn,
+    TokenLiteral,
+    TokenTitle,
+    TokenString,
+    TokenNumber,
+    TokenComment,
+    TokenMeta,
+    TokenVariable,
+    TokenAttribute,
+    NumOfTokenClasses
+};
+
+static const char *c_tokenClassNames[NumOfTokenClasses] =
+{
+    "hljs-keyword",
+    "hljs-built_in",
+    "hljs-literal",
+    "hljs-title",
+    "hljs-string",
+    "hljs-number",
+    "hljs-comment",
+    "hljs-meta",
+    "hljs-variable",
+    "hljs-attr"
+};
+
+// Definition of a lexer in the table.
+struct VLexerDef
+{
+    // Names and aliases of the language.
+    const char *m_names;
+
+    int m_flags;
+
+    const char *m_keywords;
+
+    const char *m_builtIns;
+
+    const char *m_literals;
+
+    // Keywords after which an identifier is a title, like "def" and "class".
+    const char *m_titleKeywords;
+};
+
+static const VLexerDef c_lexerDefs[] =
+{
+    {
+        "c cpp c++ cc cxx h hpp hh hxx",
+        SlashComment | BlockComment | Preprocessor | SingleQuoteString,
+        "alignas alignof asm auto bool break case catch char char16_t char32_t class const "
+        "const_cast constexpr continue decltype default delete do double dynamic_cast else "
+        "enum explicit export extern final float for friend goto if inline int long mutable "
+        "namespace new noexcept operator override private protected public register "
+        "reinterpret_cast return short signed sizeof static static_assert static_cast struct "
+        "switch template this thread_local throw try typedef typeid typename union unsigned "
+        "using virtual void volatile wchar_t while",
+        "std string vector map set list deque queue stack pair unique_ptr shared_ptr weak_ptr "
+        "size_t int8_t int16_t int32_t int64_t uint8_t uint16_t uint32_t uint64_t printf "
+        "fprintf sprintf snprintf scanf malloc calloc realloc free memcpy memset strlen strcmp "
+        "strcpy cout cin cerr endl assert",
+        "true false nullptr NULL",
+        "class struct enum union namespace"
+    },
+    {
+        "python py python3 gyp",
+        HashComment | SingleQuoteString | TripleQuoteString | Decorator,
+        "and as assert async await break class continue def del elif else except exec finally "
+        "for from global if import in is lambda nonlocal not or pass print raise return try "
+        "while with yield",
+        "abs all any bin bool bytearray bytes callable chr classmethod compile complex delattr "
+        "dict dir divmod enumerate eval filter float format frozenset getattr globals hasattr "
+        "hash help hex id input int isinstance issubclass iter len list locals map max "
+        "memoryview min next object oct open ord pow property range repr reversed round self "
+        "set setattr slice sorted staticmethod str sum super tuple type vars zip",
+        "True False None",
+        "def class"
+    },
+    {
+        "bash sh shell zsh",
+        HashComment | SingleQuoteString | MultiLineString | DollarVariable,
+        "if then else elif fi for while until in do done case esac function select return "
+        "break continue exit local export readonly declare unset shift source time",
+        "echo printf read cd pwd test eval exec set trap wait kill alias type which cat grep "
+        "sed awk ls rm cp mv mkdir chmod chown find xargs sort uniq head tail tr cut sudo",
+        "true false",
+        "function"
+    },
+    {
+        "json",
+        StringKey,
+        "",
+        "",
+        "true false null",
+        ""
+    },
+    {
+        "yaml yml",
+        HashComment | SingleQuoteString | StringKey | YamlKey,
+        "",
+        "",
+        "true false yes no on off null",
+        ""
+    },
+    {
+        "sql",
+        DashComment | BlockComment | SingleQuoteString | CaseInsensitive,
+        "add all alter and as asc begin between by case check column commit constraint create "
+        "cross database default delete desc distinct drop else end exists foreign from full "
+        "grant group having if in index inner insert into is join key left like limit not "
+        "offset on or order outer primary references returning revoke right rollback schema "
+        "select set table then transaction truncate union unique update values view when "
+        "where with",
+        "avg bigint blob boolean cast char coalesce convert count date datetime decimal double "
+        "float int integer max min numeric serial smallint sum text timestamp varchar",
+        "null true false",
+        ""
+    },
+    {
+        "go golang",
+        SlashComment | BlockComment | SingleQuoteString | BacktickString,
+        "break case chan const continue default defer else fallthrough for func go goto if "
+        "import interface map package range return select struct switch type var",
+        "append cap close complex copy delete imag len make new panic print println real "
+        "recover bool byte complex64 complex128 error float32 float64 int int8 int16 int32 "
+        "int64 rune string uint uint8 uint16 uint32 uint64 uintptr",
+        "true false nil iota",
+        "func type"
+    },
+    {
+        "javascript js jsx",
+        SlashComment | BlockComment | SingleQuoteString | BacktickString | DollarIdentifier,
+        "async await break case catch class const continue debugger default delete do else "
+        "export extends finally for from function get if import in instanceof let new of "
+        "return set static super switch this throw try typeof var void while with yield",
+        "Array Boolean Date Error Function JSON Math Number Object Promise Proxy RegExp Map "
+        "Set String Symbol WeakMap WeakSet console window document require module exports "
+        "parseInt parseFloat isNaN setTimeout setInterval",
+        "true false null undefined NaN Infinity",
+        "function class"
+    }
+};
+
+struct VLexer
+{
+    int m_flags;
+    QSet<QString> m_keywords;
+    QSet<QString> m_builtIns;
+    QSet<QString> m_literals;
+    QSet<QString> m_titleKeywords;
+};
+
+static QSet<QString> wordSet(const char *p_words)
+{
+    QStringList words = QString(p_words).split(' ', QString::SkipEmptyParts);
+    return QSet<QString>::fromList(words);
+}
+
+// Lexers keyed by the lower-case language names.
+// Built once and read-only afterwards, so it is safe to share among threads.
+static const QHash<QString, const VLexer *> &lexers()
+{
+    static QVector<VLexer> lexerList;
+    static QHash<QString, const VLexer *> table = []() {
+        int nrDefs = sizeof(c_lexerDefs) / sizeof(c_lexerDefs[0]);
+        lexerList.resize(nrDefs);
+        QHash<QString, const VLexer *> names;
+        for (int i = 0; i < nrDefs; ++i) {
+            const VLexerDef &def = c_lexerDefs[i];
+            VLexer &lexer = lexerList[i];
+            lexer.m_flags = def.m_flags;
+            lexer.m_keywords = wordSet(def.m_keywords);
+            lexer.m_builtIns = wordSet(def.m_builtIns);
+            lexer.m_literals = wordSet(def.m_literals);
+            lexer.m_titleKeywords = wordSet(def.m_titleKeywords);
+            for (auto const & name : wordSet(def.m_names)) {
+                names.insert(name, &lexer);
+            }
+        }
+
+        return names;
+    }();
+
+    return table;
+}
+
+static const VLexer *findLexer(const QString &p_lang)
+{
+    return lexers().value(p_lang.trimmed().toLower(), NULL);
+}
+
+static inline bool isIdentifierStart(QChar p_ch, int p_flags)
+{
+    return p_ch.isLetter()
+           || p_ch == '_'
+           || (p_ch == '$' && (p_flags & DollarIdentifier));
+}
+
+static inline bool isIdentifierChar(QChar p_ch, int p_flags)
+{
+    return isIdentifierStart(p_ch, p_flags) || p_ch.isDigit();
+}
+
+// Tokenize @p_text in [@p_begin, @p_end).
+class VCodeBlockScanner
+{
+public:
+    VCodeBlockScanner(const VLexer *p_lexer, const QString &p_text,
+                      int p_begin, int p_end, int p_offset,
+                      const QHash<QString, quint16> &p_styleIds)
+        : m_lexer(p_lexer), m_flags(p_lexer->m_flags), m_text(p_text),
+          m_end(p_end), m_pos(p_begin), m_offset(p_offset), m_expectTitle(false)
+    {
+        for (int i = 0; i < NumOfTokenClasses; ++i) {
+            auto it = p_styleIds.find(c_tokenClassNames[i]);
+            m_styleIds[i] = it != p_styleIds.end() ? it.value() : -1;
+        }
+    }
+
+    QList<HLUnitPos> scan();
+
+private:
+    QChar at(int p_pos) const
+    {
+        return p_pos < m_end ? m_text[p_pos] : QChar();
+    }
+
+    bool startsWith(const char *p_str) const
+    {
+        int i = m_pos;
+        for (; *p_str != '\0'; ++p_str, ++i) {
+            if (i >= m_end || m_text[i] != QLatin1Char(*p_str)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int lineEnd(int p_pos) const
+    {
+        int idx = m_text.indexOf('\n', p_pos);
+        return (idx == -1 || idx > m_end) ? m_end : idx;
+    }
+
+    void addUnit(int p_start, int p_end, TokenClass p_class)
+    {
+        int styleId = m_styleIds[p_class];
+        if (p_end > p_start && styleId != -1) {
+            m_units.append(HLUnitPos(m_offset + p_start, p_end - p_start, styleId));
+        }
+    }
+
+    // Return the end of a string starting at @m_pos.
+    int scanString(const QString &p_quote, bool p_multiLine) const;
+
+    int scanNumber() const;
+
+    // Whether a key is followed by ':' at @p_pos.
+    bool isFollowedByColon(int p_pos) const;
+
+    void scanWord(bool p_lineStart);
+
+    const VLexer *m_lexer;
+    int m_flags;
+    const QString &m_text;
+    int m_end;
+    int m_pos;
+
+    // Global position of @m_text.
+    int m_offset;
+
+    // The previous word is a title keyword.
+    bool m_expectTitle;
+
+    // Style id of each TokenClass. -1 for those without a style.
+    int m_styleIds[NumOfTokenClasses];
+
+    QList<HLUnitPos> m_units;
+};
+
+int VCodeBlockScanner::scanString(const QString &p_quote, bool p_multiLine) const
+{
+    // Shell does not escape within single quotes.
+    bool escapable = !(p_quote == "'" && (m_flags & DollarVariable));
+    int i = m_pos + p_quote.size();
+    while (i < m_end) {
+        QChar ch = m_text[i];
+        if (ch == '\\' && escapable) {
+            i += 2;
+        } else if (ch == '\n' && !p_multiLine) {
+            return i;
+        } else if (m_text.midRef(i, p_quote.size()) == p_quote) {
+            return i + p_quote.size();
+        } else {
+            ++i;
+        }
+    }
+
+    return m_end;
+}
+
+int VCodeBlockScanner::scanNumber() const
+{
+    int i = m_pos;
+    while (i < m_end) {
+        QChar ch = m_text[i];
+        if (ch.isLetterOrNumber() || ch == '_' || ch == '.') {
+            QChar prev = ch.toLower();
+            ++i;
+            if ((prev == 'e' || prev == 'p')
+                && i < m_end
+                && (m_text[i] == '+' || m_text[i] == '-')) {
+                ++i;
+            }
+        } else {
+            break;
+        }
+    }
+
+    return i;
+}
+
+bool VCodeBlockScanner::isFollowedByColon(int p_pos) const
+{
+    while (p_pos < m_end && (m_text[p_pos] == ' ' || m_text[p_pos] == '\t')) {
+        ++p_pos;
+    }
+
+    if (at(p_pos) != ':') {
+        return false;
+    }
+
+    // YAML requires a space after the colon.
+    QChar next = at(p_pos + 1);
+    return !(m_flags & YamlKey) || next.isNull() || next.isSpace();
+}
+
+void VCodeBlockScanner::scanWord(bool p_lineStart)
+{
+    int start = m_pos;
+    if ((m_flags & YamlKey) && p_lineStart) {
+        // A plain key may contain spaces and dashes.
+        int i = start;
+        while (i < m_end
+               && m_text[i] != ':'
+               && m_text[i] != '\n'
+               && m_text[i] != '#') {
+            ++i;
+        }
+
+        if (isFollowedByColon(i)) {
+            int keyEnd = i;
+            while (keyEnd > start && m_text[keyEnd - 1].isSpace()) {
+                --keyEnd;
+            }
+
+            addUnit(start, keyEnd, TokenAttribute);
+            m_pos = i + 1;
+            return;
+        }
+    }
+
+    int i = start + 1;
+    while (i < m_end && isIdentifierChar(m_text[i], m_flags)) {
+        ++i;
+    }
+
+    m_pos = i;
+
+    QString word = m_text.mid(start, i - start);
+    if (m_expectTitle) {
+        m_expectTitle = false;
+        addUnit(start, i, TokenTitle);
+        return;
+    }
+
+    QString key = (m_flags & CaseInsensitive) ? word.toLower() : word;
+    if ((m_flags & YamlKey) && isFollowedByColon(i)) {
+        addUnit(start, i, TokenAttribute);
+    } else if (m_lexer->m_keywords.contains(key)) {
+        addUnit(start, i, TokenKeyword);
+        m_expectTitle = m_lexer->m_titleKeywords.contains(key);
+    } else if (m_lexer->m_literals.contains(key)) {
+        addUnit(start, i, TokenLiteral);
+    } else if (m_lexer->m_builtIns.contains(key)) {
+        addUnit(start, i, TokenBuiltIn);
+    }
+}
+
+QList<HLUnitPos> VCodeBlockScanner::scan()
+{
+    bool lineStart = true;
+    while (m_pos < m_end) {
+        int start = m_pos;
+        QChar ch = m_text[m_pos];
+        if (ch == '\n') {
+            lineStart = true;
+            ++m_pos;
+            continue;
+        } else if (ch.isSpace()) {
+            ++m_pos;
+            continue;
+        }
+
+        bool atLineStart = lineStart;
+        lineStart = false;
+
+        // Consume "- " of YAML list items to find the keys after it.
+        if ((m_flags & YamlKey) && atLineStart && ch == '-' && at(m_pos + 1) == ' ') {
+            m_pos += 2;
+            lineStart = true;
+            continue;
+        }
+
+        QChar prev = start > 0 ? m_text[start - 1] : QChar('\n');
+        if (ch == '#' && (m_flags & Preprocessor) && atLineStart) {
+            m_pos = lineEnd(m_pos);
+            addUnit(start, m_pos, TokenMeta);
+        } else if (ch == '#' && (m_flags & HashComment) && prev.isSpace()) {
+            m_pos = lineEnd(m_pos);
+            addUnit(start, m_pos, TokenComment);
+        } else if ((m_flags & SlashComment) && startsWith("//")) {
+            m_pos = lineEnd(m_pos);
+            addUnit(start, m_pos, TokenComment);
+        } else if ((m_flags & DashComment) && startsWith("--")) {
+            m_pos = lineEnd(m_pos);
+            addUnit(start, m_pos, TokenComment);
+        } else if ((m_flags & BlockComment) && startsWith("/*")) {
+            int idx = m_text.indexOf("*/", m_pos + 2);
+            m_pos = (idx == -1 || idx + 2 > m_end) ? m_end : idx + 2;
+            addUnit(start, m_pos, TokenComment);
+        } else if (ch == '"' || (ch == '\'' && (m_flags & SingleQuoteString))) {
+            bool multiLine = m_flags & MultiLineString;
+            QString quote(ch);
+            if ((m_flags & TripleQuoteString) && (startsWith("\"\"\"") || startsWith("'''"))) {
+                quote = QString(3, ch);
+                multiLine = true;
+            }
+
+            m_pos = scanString(quote, multiLine);
+            if ((m_flags & StringKey) && isFollowedByColon(m_pos)) {
+                addUnit(start, m_pos, TokenAttribute);
+            } else {
+                addUnit(start, m_pos, TokenString);
+            }
+        } else if (ch == '`' && (m_flags & BacktickString)) {
+            m_pos = scanString("`", true);
+            addUnit(start, m_pos, TokenString);
+        } else if (ch.isDigit() || (ch == '.' && at(m_pos + 1).isDigit())) {
+            m_pos = scanNumber();
+            addUnit(start, m_pos, TokenNumber);
+        } else if (ch == '$' && (m_flags & DollarVariable)) {
+            QChar next = at(m_pos + 1);
+            if (next == '{') {
+                int idx = m_text.indexOf('}', m_pos);
+                m_pos = (idx == -1 || idx >= m_end) ? lineEnd(m_pos) : idx + 1;
+            } else if (isIdentifierStart(next, m_flags)) {
+                m_pos += 2;
+                while (m_pos < m_end && isIdentifierChar(m_text[m_pos], m_flags)) {
+                    ++m_pos;
+                }
+            } else if (next.isDigit() || QString("@#?$!*-").contains(next)) {
+                m_pos += 2;
+            } else {
+                ++m_pos;
+            }
+
+            addUnit(start, m_pos, TokenVariable);
+        } else if (ch == '@' && (m_flags & Decorator) && isIdentifierStart(at(m_pos + 1), m_flags)) {
+            m_pos += 2;
+            while (m_pos < m_end
+                   && (isIdentifierChar(m_text[m_pos], m_flags) || m_text[m_pos] == '.')) {
+                ++m_pos;
+            }
+
+            addUnit(start, m_pos, TokenMeta);
+        } else if (isIdentifierStart(ch, m_flags)
+                   || ((m_flags & YamlKey) && atLineStart)) {
+            scanWord(atLineStart);
+            continue;
+        } else {
+            ++m_pos;
+        }
+
+        // Only an identifier right after a title keyword is a title.
+        m_expectTitle = false;
+    }
+
+    return m_units;
+}
+
+VCodeBlockTokenizer::VCodeBlockTokenizer(QObject *p_parent)
+    : QThread(p_parent), m_busy(false), m_cancelFlag(0), m_hasPendingRequest(false)
+{
+    connect(this, &QThread::finished,
+            this, &VCodeBlockTokenizer::handleFinished);
+}
+
+VCodeBlockTokenizer::~VCodeBlockTokenizer()
+{
+    m_cancelFlag.storeRelease(1);
+    wait();
+}
+
+bool VCodeBlockTokenizer::isLanguageSupported(const QString &p_lang)
+{
+    return findLexer(p_lang) != NULL;
+}
+
+QList<HLUnitPos> VCodeBlockTokenizer::tokenize(const VCodeBlock &p_block,
+                                               const QHash<QString, quint16> &p_styleIds)
+{
+    const VLexer *lexer = findLexer(p_block.m_lang);
+    if (!lexer) {
+        return QList<HLUnitPos>();
+    }
+
+    // Skip the fences.
+    const QString &text = p_block.m_text;
+    int begin = text.indexOf('\n');
+    int end = text.lastIndexOf('\n');
+    if (begin == -1 || end <= begin) {
+        return QList<HLUnitPos>();
+    }
+
+    VCodeBlockScanner scanner(lexer, text, begin + 1, end, p_block.m_startPos, p_styleIds);
+    return scanner.scan();
+}
+
+void VCodeBlockTokenizer::tokenizeAsync(int p_timeStamp,
+                                        const QList<VCodeBlock> &p_blocks,
+                                        const QVector<int> &p_ids,
+                                        const QHash<QString, quint16> &p_styleIds)
+{
+    Q_ASSERT(p_blocks.size() == p_ids.size());
+    Request req;
+    req.m_timeStamp = p_timeStamp;
+    req.m_blocks = p_blocks;
+    req.m_ids = p_ids;
+    req.m_styleIds = p_styleIds;
+
+    if (m_busy) {
+        m_pendingRequest = req;
+        m_hasPendingRequest = true;
+        m_cancelFlag.storeRelease(1);
+        return;
+    }
+
+    m_busy = true;
+    m_cancelFlag.storeRelease(0);
+    m_request = req;
+    start();
+}
+
+void VCodeBlockTokenizer::run()
+{
+    m_result.clear();
+    m_result.reserve(m_request.m_blocks.size());
+    for (int i = 0; i < m_request.m_blocks.size(); ++i) {
+        if (m_cancelFlag.loadAcquire()) {
+            return;
+        }
+
+        VCodeBlockTokens tokens;
+        tokens.m_id = m_request.m_ids[i];
+        tokens.m_units = tokenize(m_request.m_blocks[i], m_request.m_styleIds);
+        m_result.append(tokens);
+    }
+}
+
+void VCodeBlockTokenizer::handleFinished()
+{
+    Q_ASSERT(m_busy);
+    m_busy = false;
+
+    int timeStamp = m_request.m_timeStamp;
+    m_request = Request();
+
+    if (m_hasPendingRequest) {
+        m_hasPendingRequest = false;
+        m_busy = true;
+        m_cancelFlag.storeRelease(0);
+        m_request = m_pendingRequest;
+        m_pendingRequest = Request();
+        m_result.clear();
+        start();
+        return;
+    }
+
+    QVector<VCodeBlockTokens> result = m_result;
+    m_result.clear();
+    emit tokenized(timeStamp, result);
+}
@@ -0,0 +1,94 @@
+#ifndef VCODEBLOCKTOKENIZER_H
+#define VCODEBLOCKTOKENIZER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QHash>
+#include "hgmarkdownhighlighter.h"
+
+// Highlight units of one code block.
+struct VCodeBlockTokens
+{
+    VCodeBlockTokens() : m_id(-1)
+    {
+    }
+
+    // Index of the code block in the request.
+    int m_id;
+
+    QList<HLUnitPos> m_units;
+};
+
+// Tokenize fenced code blocks in process with table-driven lexers on a worker
+// thread. Units use the class names of highlight.js so the code block styles
+// apply to them as well.
+class VCodeBlockTokenizer : public QThread
+{
+    Q_OBJECT
+public:
+    explicit VCodeBlockTokenizer(QObject *p_parent = 0);
+
+    ~VCodeBlockTokenizer();
+
+    // Tokenize @p_blocks asynchronously. @p_ids are the ids of each block to
+    // be returned in the result. @p_styleIds maps class names to style ids.
+    // If it is busy now, current request will be cancelled and this one will
+    // be handled after it stops.
+    void tokenizeAsync(int p_timeStamp,
+                       const QList<VCodeBlock> &p_blocks,
+                       const QVector<int> &p_ids,
+                       const QHash<QString, quint16> &p_styleIds);
+
+    // Whether there is a lexer for language @p_lang of a fenced code block.
+    static bool isLanguageSupported(const QString &p_lang);
+
+    // Tokenize @p_block synchronously. Positions of the units are global.
+    // The fences are not tokenized. Tokens of classes not in @p_styleIds
+    // are dropped.
+    static QList<HLUnitPos> tokenize(const VCodeBlock &p_block,
+                                     const QHash<QString, quint16> &p_styleIds);
+
+signals:
+    // Emitted in the thread of the tokenizer object.
+    void tokenized(int p_timeStamp, const QVector<VCodeBlockTokens> &p_result);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private slots:
+    void handleFinished();
+
+private:
+    struct Request
+    {
+        Request() : m_timeStamp(0)
+        {
+        }
+
+        int m_timeStamp;
+        QList<VCodeBlock> m_blocks;
+        QVector<int> m_ids;
+
+        // A copy to be read in the worker thread.
+        QHash<QString, quint16> m_styleIds;
+    };
+
+    Request m_request;
+
+    QVector<VCodeBlockTokens> m_result;
+
+    // Whether the thread is running or its result has not been handled.
+    bool m_busy;
+
+    // Set on the GUI thread to cancel current request.
+    QAtomicInt m_cancelFlag;
+
+    bool m_hasPendingRequest;
+
+    Request m_pendingRequest;
+};
+
+#endif // VCODEBLOCKTOKENIZER_H
@@ -150,6 +150,33 @@ void VConfigManager::initialize()
 
     m_enableSmartImInVimMode = getConfigFromSettings("global",
                                                      "enable_smart_im_in_vim_mode").toBool();
+
+    m_largeNoteSize = getConfigFromSettings("global",
+                                            "large_note_size").toInt();
+
+    m_minHighlightDelay = getConfigFromSettings("global",
+                                                "min_highlight_delay").toInt();
+    m_maxHighlightDelay = getConfigFromSettings("global",
+                                                "max_highlight_delay").toInt();
+    m_minPreviewImageDelay = getConfigFromSettings("global",
+                                                   "min_preview_image_delay").toInt();
+    m_maxPreviewImageDelay = getConfigFromSettings("global",
+                                                   "max_preview_image_delay").toInt();
+    m_minOutlineDelay = getConfigFromSettings("global",
+                                              "min_outline_delay").toInt();
+    m_maxOutlineDelay = getConfigFromSettings("global",
+                                              "max_outline_delay").toInt();
+
+    m_imageCacheSize = getConfigFromSettings("global",
+                                             "image_cache_size").toInt();
+
+    m_thumbnailCacheSize = getConfigFromSettings("global",
+                                                 "thumbnail_cache_size").toInt();
+
+    m_enableLazyImagePreview = getConfigFromSettings("global",
+                                                     "enable_lazy_image_preview").toBool();
+    m_retireFarImagePreviews = getConfigFromSettings("global",
+                                                     "retire_far_image_previews").toBool();
 }
 
 void VConfigManager::readPredefinedColorsFromSettings()
@@ -328,6 +355,19 @@ QString VConfigManager::getLogFilePath()
     return logPath;
 }
 
+QString VConfigManager::getThumbnailFolder()
+{
+    static QString thumbnailFolder;
+
+    if (thumbnailFolder.isEmpty()) {
+        QDir dir(VUtils::basePathFromPath(getLogFilePath()));
+        dir.mkdir("thumbnails");
+        thumbnailFolder = dir.filePath("thumbnails");
+    }
+
+    return thumbnailFolder;
+}
+
 void VConfigManager::updateMarkdownEditStyle()
 {
     static const QString defaultCurrentLineBackground = "#C5CAE9";
@@ -355,7 +395,7 @@ void VConfigManager::updateMarkdownEditStyle()
     parser.fetchMarkdownEditorStyles(mdEditPalette, mdEditFont, styles);
 
     mdHighlightingStyles = parser.fetchMarkdownStyles(mdEditFont);
-    m_codeBlockStyles = parser.fetchCodeBlockStyles(mdEditFont);
+    updateCodeBlockFormats(parser.fetchCodeBlockStyles(mdEditFont));
 
     m_editorCurrentLineBg = defaultCurrentLineBackground;
     m_editorVimInsertBg = defaultVimInsertBg;
@@ -401,6 +441,36 @@ void VConfigManager::updateMarkdownEditStyle()
     }
 }
 
+void VConfigManager::updateCodeBlockFormats(const QHash<QString, QTextCharFormat> &p_styles)
+{
+    for (auto it = p_styles.begin(); it != p_styles.end(); ++it) {
+        if (!m_codeBlockStyleIds.contains(it.key())) {
+            quint16 id = m_codeBlockStyleIds.size();
+            m_codeBlockStyleIds.insert(it.key(), id);
+        }
+    }
+
+    int nrStyles = m_codeBlockStyleIds.size();
+    QVector<QTextCharFormat> &formats = m_codeBlockFormats.m_formats;
+    formats.fill(QTextCharFormat(), nrStyles);
+    for (auto it = m_codeBlockStyleIds.begin(); it != m_codeBlockStyleIds.end(); ++it) {
+        auto styleIt = p_styles.find(it.key());
+        if (styleIt != p_styles.end()) {
+            formats[it.value()] = styleIt.value();
+        }
+    }
+
+    QVector<QTextCharFormat> &mergedFormats = m_codeBlockFormats.m_mergedFormats;
+    mergedFormats.resize(nrStyles * nrStyles);
+    for (int outer = 0; outer < nrStyles; ++outer) {
+        for (int inner = 0; inner < nrStyles; ++inner) {
+            QTextCharFormat format = formats[outer];
+            format.merge(formats[inner]);
+            mergedFormats[outer * nrStyles + inner] = format;
+        }
+    }
+}
+
 void VConfigManager::updateEditStyle()
 {
     // Reset font and palette.
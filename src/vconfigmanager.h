@@ -44,6 +44,10 @@ public:
 
     static QString getLogFilePath();
 
+    // Get the folder of the thumbnails of the previewed images, next to the
+    // log file.
+    static QString getThumbnailFolder();
+
     // Get the path of the folder used to store default notebook.
     static QString getVnoteNotebookFolderPath();
 
@@ -67,7 +71,10 @@ public:
 
     inline QVector<HighlightingStyle> getMdHighlightingStyles() const;
 
-    inline QHash<QString, QTextCharFormat> getCodeBlockStyles() const;
+    inline const HLCodeBlockFormats &getCodeBlockFormats() const;
+
+    // Interned ids of the code block styles, like "hljs-keyword".
+    inline const QHash<QString, quint16> &getCodeBlockStyleIds() const;
 
     inline QString getWelcomePagePath() const;
 
@@ -199,6 +206,25 @@ public:
     inline bool getEnableSmartImInVimMode() const;
     inline void setEnableSmartImInVimMode(bool p_enabled);
 
+    inline int getLargeNoteSize() const;
+
+    inline int getMinHighlightDelay() const;
+    inline int getMaxHighlightDelay() const;
+
+    inline int getMinPreviewImageDelay() const;
+    inline int getMaxPreviewImageDelay() const;
+
+    inline int getMinOutlineDelay() const;
+    inline int getMaxOutlineDelay() const;
+
+    inline int getImageCacheSize() const;
+
+    inline int getThumbnailCacheSize() const;
+
+    inline bool getEnableLazyImagePreview() const;
+
+    inline bool getRetireFarImagePreviews() const;
+
     // Get the folder the ini file exists.
     QString getConfigFolder() const;
 
@@ -231,6 +257,9 @@ private:
 
     void updateMarkdownEditStyle();
 
+    // Intern the names of @p_styles and compute the formats of each style id.
+    void updateCodeBlockFormats(const QHash<QString, QTextCharFormat> &p_styles);
+
     // Migrate ini file from tamlok/vnote.ini to vnote/vnote.ini.
     // This is for the change of org name.
     void migrateIniFile();
@@ -255,7 +284,12 @@ private:
     QPalette mdEditPalette;
 
     QVector<HighlightingStyle> mdHighlightingStyles;
-    QHash<QString, QTextCharFormat> m_codeBlockStyles;
+
+    // Ids are never reused, so highlights computed with previous styles
+    // remain valid.
+    QHash<QString, quint16> m_codeBlockStyleIds;
+
+    HLCodeBlockFormats m_codeBlockFormats;
 
     QString welcomePagePath;
     QString m_templateCss;
@@ -364,6 +398,30 @@ private:
     // Enable smart input method in Vim mode.
     bool m_enableSmartImInVimMode;
 
+    // Notes with more characters than this are highlighted lazily.
+    int m_largeNoteSize;
+
+    // Bounds in ms of the adaptive delays after typing before re-highlighting,
+    // previewing images and updating the outline.
+    int m_minHighlightDelay;
+    int m_maxHighlightDelay;
+    int m_minPreviewImageDelay;
+    int m_maxPreviewImageDelay;
+    int m_minOutlineDelay;
+    int m_maxOutlineDelay;
+
+    // Budget in MB of the decoded images shared by all the notes.
+    int m_imageCacheSize;
+
+    // Budget in MB of the thumbnails on disk. 0 to disable them.
+    int m_thumbnailCacheSize;
+
+    // Preview only the images around the viewport in edit mode.
+    bool m_enableLazyImagePreview;
+
+    // Remove the image previews far from the viewport if lazy.
+    bool m_retireFarImagePreviews;
+
     // The name of the config file in each directory, obsolete.
     // Use c_dirConfigFile instead.
     static const QString c_obsoleteDirConfigFile;
@@ -406,9 +464,14 @@ inline QVector<HighlightingStyle> VConfigManager::getMdHighlightingStyles() cons
     return mdHighlightingStyles;
 }
 
-inline QHash<QString, QTextCharFormat> VConfigManager::getCodeBlockStyles() const
+inline const HLCodeBlockFormats &VConfigManager::getCodeBlockFormats() const
+{
+    return m_codeBlockFormats;
+}
+
+inline const QHash<QString, quint16> &VConfigManager::getCodeBlockStyleIds() const
 {
-    return m_codeBlockStyles;
+    return m_codeBlockStyleIds;
 }
 
 inline QString VConfigManager::getWelcomePagePath() const
@@ -964,4 +1027,59 @@ inline void VConfigManager::setEnableSmartImInVimMode(bool p_enabled)
                         m_enableSmartImInVimMode);
 }
 
+inline int VConfigManager::getLargeNoteSize() const
+{
+    return m_largeNoteSize;
+}
+
+inline int VConfigManager::getMinHighlightDelay() const
+{
+    return m_minHighlightDelay;
+}
+
+inline int VConfigManager::getMaxHighlightDelay() const
+{
+    return m_maxHighlightDelay;
+}
+
+inline int VConfigManager::getMinPreviewImageDelay() const
+{
+    return m_minPreviewImageDelay;
+}
+
+inline int VConfigManager::getMaxPreviewImageDelay() const
+{
+    return m_maxPreviewImageDelay;
+}
+
+inline int VConfigManager::getMinOutlineDelay() const
+{
+    return m_minOutlineDelay;
+}
+
+inline int VConfigManager::getMaxOutlineDelay() const
+{
+    return m_maxOutlineDelay;
+}
+
+inline int VConfigManager::getImageCacheSize() const
+{
+    return m_imageCacheSize;
+}
+
+inline int VConfigManager::getThumbnailCacheSize() const
+{
+    return m_thumbnailCacheSize;
+}
+
+inline bool VConfigManager::getEnableLazyImagePreview() const
+{
+    return m_enableLazyImagePreview;
+}
+
+inline bool VConfigManager::getRetireFarImagePreviews() const
+{
+    return m_retireFarImagePreviews;
+}
+
 #endif // VCONFIGMANAGER_H
@@ -70,11 +70,28 @@ void VDocument::highlightTextAsync(const QString &p_text, int p_id, int p_timeSt
     emit requestHighlightText(p_text, p_id, p_timeStamp);
 }
 
+void VDocument::highlightTextBatchAsync(const QStringList &p_texts, const QVariantList &p_ids,
+                                        int p_timeStamp)
+{
+    emit requestHighlightTextBatch(p_texts, p_ids, p_timeStamp);
+}
+
 void VDocument::highlightTextCB(const QString &p_html, int p_id, int p_timeStamp)
 {
     emit textHighlighted(p_html, p_id, p_timeStamp);
 }
 
+void VDocument::highlightTextCB2(const QJsonArray &p_units, const QJsonArray &p_classes,
+                                 int p_id, int p_timeStamp)
+{
+    emit textHighlightedOffsets(p_units, p_classes, p_id, p_timeStamp);
+}
+
+void VDocument::highlightTextBatchCB(const QJsonArray &p_results, int p_timeStamp)
+{
+    emit textHighlightedBatch(p_results, p_timeStamp);
+}
+
 void VDocument::noticeReadyToHighlightText()
 {
     emit readyToHighlightText();
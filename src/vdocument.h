@@ -3,6 +3,9 @@
 
 #include <QObject>
 #include <QString>
+#include <QJsonArray>
+#include <QStringList>
+#include <QVariantList>
 
 class VFile;
 
@@ -23,6 +26,11 @@ public:
     // Use p_id to identify the result.
     void highlightTextAsync(const QString &p_text, int p_id, int p_timeStamp);
 
+    // Request to highlight @p_texts in one message.
+    // Use @p_ids to identify the results.
+    void highlightTextBatchAsync(const QStringList &p_texts, const QVariantList &p_ids,
+                                 int p_timeStamp);
+
     void setFile(const VFile *p_file);
 
 public slots:
@@ -41,6 +49,16 @@ public slots:
     void keyPressEvent(int p_key, bool p_ctrl, bool p_shift);
     void updateText();
     void highlightTextCB(const QString &p_html, int p_id, int p_timeStamp);
+
+    // @p_units: flat array of [offset, length, classId] triples of the
+    // highlighted ranges in the requested text;
+    // @p_classes: class names indexed by classId;
+    void highlightTextCB2(const QJsonArray &p_units, const QJsonArray &p_classes,
+                          int p_id, int p_timeStamp);
+
+    // @p_results: array of {id, units, classes} objects, like the arguments
+    // of highlightTextCB2().
+    void highlightTextBatchCB(const QJsonArray &p_results, int p_timeStamp);
     void noticeReadyToHighlightText();
 
     // Web-side handle logics (MathJax etc.) is finished.
@@ -56,7 +74,12 @@ signals:
     void logChanged(const QString &p_log);
     void keyPressed(int p_key, bool p_ctrl, bool p_shift);
     void requestHighlightText(const QString &p_text, int p_id, int p_timeStamp);
+    void requestHighlightTextBatch(const QStringList &p_texts, const QVariantList &p_ids,
+                                   int p_timeStamp);
     void textHighlighted(const QString &p_html, int p_id, int p_timeStamp);
+    void textHighlightedOffsets(const QJsonArray &p_units, const QJsonArray &p_classes,
+                                int p_id, int p_timeStamp);
+    void textHighlightedBatch(const QJsonArray &p_results, int p_timeStamp);
     void readyToHighlightText();
     void logicsFinished();
 
@@ -0,0 +1,108 @@
+#include "vformatrunbuilder.h"
+
+const int VFormatRunBuilder::c_maxCombos = 1024;
+
+VFormatRunBuilder::VFormatRunBuilder()
+    : m_length(0), m_painted(false)
+{
+}
+
+void VFormatRunBuilder::reset(int p_length)
+{
+    m_length = p_length;
+    m_painted = false;
+    m_charCombos.fill(-1, p_length);
+    m_runs.resize(0);
+
+    if (m_combos.size() > c_maxCombos) {
+        m_combos.clear();
+        m_comboIndex.clear();
+    }
+}
+
+int VFormatRunBuilder::comboIndex(int p_parent, const QTextCharFormat *p_format)
+{
+    QPair<int, const QTextCharFormat *> key(p_parent, p_format);
+    auto it = m_comboIndex.find(key);
+    if (it != m_comboIndex.end()) {
+        return it.value();
+    }
+
+    Combo combo;
+    combo.m_parent = p_parent;
+    combo.m_format = p_format;
+    if (p_parent == -1) {
+        combo.m_merged = *p_format;
+    } else {
+        combo.m_merged = m_combos[p_parent].m_merged;
+        combo.m_merged.merge(*p_format);
+    }
+
+    int idx = m_combos.size();
+    m_combos.append(combo);
+    m_comboIndex.insert(key, idx);
+    return idx;
+}
+
+void VFormatRunBuilder::addLayer(int p_start, int p_length,
+                                 const QTextCharFormat *p_format, bool p_opaque)
+{
+    int start = qMax(p_start, 0);
+    int end = qMin(p_start + p_length, m_length);
+    if (start >= end) {
+        return;
+    }
+
+    m_painted = true;
+    int *combos = m_charCombos.data();
+    if (p_opaque) {
+        int idx = comboIndex(-1, p_format);
+        for (int i = start; i < end; ++i) {
+            combos[i] = idx;
+        }
+
+        return;
+    }
+
+    // Adjacent characters mostly share the same stack.
+    int lastParent = -2, lastIdx = -1;
+    for (int i = start; i < end; ++i) {
+        if (combos[i] != lastParent) {
+            lastParent = combos[i];
+            lastIdx = comboIndex(lastParent, p_format);
+        }
+
+        combos[i] = lastIdx;
+    }
+}
+
+const QVector<VFormatRunBuilder::Run> &VFormatRunBuilder::runs()
+{
+    m_runs.resize(0);
+    if (!m_painted) {
+        return m_runs;
+    }
+
+    const int *combos = m_charCombos.constData();
+    int i = 0;
+    while (i < m_length) {
+        int idx = combos[i];
+        if (idx == -1) {
+            ++i;
+            continue;
+        }
+
+        int start = i;
+        while (i < m_length && combos[i] == idx) {
+            ++i;
+        }
+
+        Run run;
+        run.m_start = start;
+        run.m_length = i - start;
+        run.m_format = &m_combos[idx].m_merged;
+        m_runs.append(run);
+    }
+
+    return m_runs;
+}
@@ -0,0 +1,74 @@
+#ifndef VFORMATRUNBUILDER_H
+#define VFORMATRUNBUILDER_H
+
+#include <QVector>
+#include <QHash>
+#include <QPair>
+#include <QTextCharFormat>
+
+// Flatten the formats painted over a block into sorted, non-overlapping runs
+// so that each run could be applied with one setFormat(). The formats of the
+// layers stacked over a character are merged from bottom to top, so a later
+// layer overrides only the properties it sets. The merged format of each
+// combination of layers is cached across blocks. Buffers are reused across
+// blocks.
+class VFormatRunBuilder
+{
+public:
+    struct Run
+    {
+        int m_start;
+        int m_length;
+        const QTextCharFormat *m_format;
+    };
+
+    VFormatRunBuilder();
+
+    // Start a new block of @p_length characters.
+    void reset(int p_length);
+
+    // Paint @p_format over [@p_start, @p_start + @p_length). @p_format should
+    // outlive the builder, since the merged formats are cached by its address.
+    // If @p_opaque, the layers below are hidden instead of merged.
+    void addLayer(int p_start, int p_length, const QTextCharFormat *p_format,
+                  bool p_opaque = false);
+
+    // Runs of the same merged format in order. Characters without any layer
+    // are not covered. The formats are valid until next reset().
+    const QVector<Run> &runs();
+
+private:
+    // A stack of layers, as @m_format over the stack @m_parent.
+    struct Combo
+    {
+        // Index in @m_combos. -1 for the empty stack.
+        int m_parent;
+        const QTextCharFormat *m_format;
+
+        // Formats of the stack merged from bottom to top.
+        QTextCharFormat m_merged;
+    };
+
+    // Index in @m_combos of @p_format over the stack @p_parent.
+    int comboIndex(int p_parent, const QTextCharFormat *p_format);
+
+    int m_length;
+
+    // Whether any layer is painted since reset().
+    bool m_painted;
+
+    QVector<Combo> m_combos;
+
+    // Map from (parent stack, format) to the index in @m_combos.
+    QHash<QPair<int, const QTextCharFormat *>, int> m_comboIndex;
+
+    // Index in @m_combos of the stack of each character. -1 for none.
+    QVector<int> m_charCombos;
+
+    QVector<Run> m_runs;
+
+    // Drop the cached combinations beyond this number at reset().
+    static const int c_maxCombos;
+};
+
+#endif // VFORMATRUNBUILDER_H
@@ -0,0 +1,117 @@
+#include "vimagecache.h"
+
+#include <QFileInfo>
+#include <QDateTime>
+#include <QFile>
+#include "vimagedecoder.h"
+#include "vconfigmanager.h"
+
+extern VConfigManager vconfig;
+
+QCache<QString, VCachedImage> VImageCache::s_cache;
+
+bool VImageCache::s_budgetInited = false;
+
+int VImageCache::s_numOfHits = 0;
+
+int VImageCache::s_numOfMisses = 0;
+
+int VImageCache::s_numOfEvictions = 0;
+
+void VImageCache::initBudget()
+{
+    if (s_budgetInited) {
+        return;
+    }
+
+    s_budgetInited = true;
+    s_cache.setMaxCost(qMax(vconfig.getImageCacheSize(), 1) * 1024);
+}
+
+QString VImageCache::cacheKey(const QString &p_path, int p_width)
+{
+    QFileInfo info(p_path);
+    if (!info.exists()) {
+        // A URL.
+        return QString("%1|%2").arg(p_width).arg(p_path);
+    }
+
+    QString path = info.canonicalFilePath();
+    if (path.isEmpty()) {
+        return QString();
+    }
+
+    return QString("%1|%2|%3").arg(p_width)
+                              .arg(info.lastModified().toMSecsSinceEpoch())
+                              .arg(path);
+}
+
+VCachedImage VImageCache::get(const QString &p_path, int p_width)
+{
+    QString key = cacheKey(p_path, p_width);
+    VCachedImage *image = key.isEmpty() ? NULL : s_cache.object(key);
+    if (!image) {
+        ++s_numOfMisses;
+        return VCachedImage();
+    }
+
+    ++s_numOfHits;
+    return *image;
+}
+
+void VImageCache::insert(const QString &p_path, int p_width, const VCachedImage &p_image)
+{
+    initBudget();
+
+    QString key = cacheKey(p_path, p_width);
+    if (key.isEmpty() || p_image.isNull()) {
+        return;
+    }
+
+    int cost = qMax(p_image.m_image.byteCount() / 1024, 1);
+    int count = s_cache.count();
+    bool replaced = s_cache.contains(key);
+    if (!s_cache.insert(key, new VCachedImage(p_image), cost)) {
+        // Larger than the whole budget.
+        return;
+    }
+
+    s_numOfEvictions += count + (replaced ? 0 : 1) - s_cache.count();
+}
+
+VCachedImage VImageCache::load(const QString &p_path, int p_width)
+{
+    VCachedImage image = get(p_path, p_width);
+    if (!image.isNull()) {
+        return image;
+    }
+
+    QFile file(p_path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return image;
+    }
+
+    image.m_image = VImageDecoder::decode(&file, p_width, image.m_originalWidth);
+    insert(p_path, p_width, image);
+    return image;
+}
+
+int VImageCache::getNumOfHits()
+{
+    return s_numOfHits;
+}
+
+int VImageCache::getNumOfMisses()
+{
+    return s_numOfMisses;
+}
+
+int VImageCache::getNumOfEvictions()
+{
+    return s_numOfEvictions;
+}
+
+qint64 VImageCache::getResidentBytes()
+{
+    return static_cast<qint64>(s_cache.totalCost()) * 1024;
+}
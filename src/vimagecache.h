@@ -0,0 +1,76 @@
+#ifndef VIMAGECACHE_H
+#define VIMAGECACHE_H
+
+#include <QCache>
+#include <QString>
+#include <QImage>
+
+// A decoded image and the width of the image it is decoded from.
+struct VCachedImage
+{
+    VCachedImage()
+        : m_originalWidth(0)
+    {
+    }
+
+    VCachedImage(const QImage &p_image, int p_originalWidth)
+        : m_image(p_image), m_originalWidth(p_originalWidth)
+    {
+    }
+
+    bool isNull() const
+    {
+        return m_image.isNull();
+    }
+
+    QImage m_image;
+
+    int m_originalWidth;
+};
+
+// Decoded images shared by all the editors and dialogs of the process. An
+// image is keyed by its canonical path, its modification time and the width
+// it is decoded at, and the least recently used ones are evicted beyond the
+// budget of image_cache_size MB. Only used in the GUI thread.
+class VImageCache
+{
+public:
+    // Look up the image @p_path decoded at @p_width (0 for its original
+    // width). @p_path may be a URL of a downloaded image.
+    static VCachedImage get(const QString &p_path, int p_width);
+
+    static void insert(const QString &p_path, int p_width, const VCachedImage &p_image);
+
+    // Get the image from the cache or decode it synchronously.
+    static VCachedImage load(const QString &p_path, int p_width);
+
+    static int getNumOfHits();
+
+    static int getNumOfMisses();
+
+    static int getNumOfEvictions();
+
+    // Bytes of the pixels of the cached images.
+    static qint64 getResidentBytes();
+
+private:
+    // Key of @p_path decoded at @p_width. Paths not found locally are taken
+    // as URLs. Empty if it fails to resolve the canonical path.
+    static QString cacheKey(const QString &p_path, int p_width);
+
+    // Apply the budget from the configuration.
+    static void initBudget();
+
+    // The cost of each entry is the KB of its pixels.
+    static QCache<QString, VCachedImage> s_cache;
+
+    static bool s_budgetInited;
+
+    static int s_numOfHits;
+
+    static int s_numOfMisses;
+
+    static int s_numOfEvictions;
+};
+
+#endif // VIMAGECACHE_H
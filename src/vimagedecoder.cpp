@@ -0,0 +1,122 @@
+#include "vimagedecoder.h"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QImageReader>
+#include <QFile>
+#include <QBuffer>
+#include <QDebug>
+#include "vthumbnailcache.h"
+
+const int VImageDecoder::c_maxThreads = 2;
+
+namespace
+{
+// Decode one image and deliver it by the signal of the decoder.
+class DecodeTask : public QRunnable
+{
+public:
+    DecodeTask(VImageDecoder *p_decoder, const QString &p_name,
+               const QByteArray &p_data, bool p_isFile, int p_width,
+               bool p_useThumbnail)
+        : m_decoder(p_decoder), m_name(p_name), m_data(p_data),
+          m_isFile(p_isFile), m_width(p_width), m_useThumbnail(p_useThumbnail)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        QImage image;
+        int originalWidth = 0;
+        if (m_isFile) {
+            if (m_useThumbnail) {
+                image = VThumbnailCache::load(m_name, m_width, originalWidth);
+            }
+
+            if (image.isNull()) {
+                QFile file(m_name);
+                if (file.open(QIODevice::ReadOnly)) {
+                    image = VImageDecoder::decode(&file, m_width, originalWidth);
+                }
+
+                // Images not downscaled are as cheap to load from the file.
+                if (m_useThumbnail && originalWidth > m_width) {
+                    VThumbnailCache::store(m_name, m_width, image, originalWidth);
+                }
+            }
+        } else {
+            QBuffer buffer(&m_data);
+            if (buffer.open(QIODevice::ReadOnly)) {
+                image = VImageDecoder::decode(&buffer, m_width, originalWidth);
+            }
+        }
+
+        if (image.isNull()) {
+            qWarning() << "fail to decode image" << m_name;
+        }
+
+        // The decoder waits for its tasks before being destroyed.
+        emit m_decoder->imageDecoded(m_name, m_width, image, originalWidth);
+    }
+
+private:
+    VImageDecoder *m_decoder;
+    QString m_name;
+    QByteArray m_data;
+    bool m_isFile;
+    int m_width;
+    bool m_useThumbnail;
+};
+}
+
+VImageDecoder::VImageDecoder(QObject *p_parent)
+    : QObject(p_parent)
+{
+    m_pool = new QThreadPool(this);
+    m_pool->setMaxThreadCount(c_maxThreads);
+}
+
+VImageDecoder::~VImageDecoder()
+{
+    m_pool->clear();
+    m_pool->waitForDone();
+}
+
+void VImageDecoder::decodeAsync(const QString &p_path, int p_width, bool p_useThumbnail)
+{
+    m_pool->start(new DecodeTask(this, p_path, QByteArray(), true, p_width, p_useThumbnail));
+}
+
+void VImageDecoder::decodeAsync(const QString &p_name, const QByteArray &p_data, int p_width)
+{
+    m_pool->start(new DecodeTask(this, p_name, p_data, false, p_width, false));
+}
+
+QImage VImageDecoder::decode(QIODevice *p_device, int p_width, int &p_originalWidth)
+{
+    QImageReader reader(p_device);
+
+    // The size is read from the header only.
+    QSize size = reader.size();
+    bool scaledByReader = false;
+    if (size.isValid()) {
+        p_originalWidth = size.width();
+        if (p_width > 0 && size.width() > p_width) {
+            reader.setScaledSize(size.scaled(p_width, size.height(), Qt::KeepAspectRatio));
+            scaledByReader = true;
+        }
+    }
+
+    QImage image = reader.read();
+    if (image.isNull() || scaledByReader) {
+        return image;
+    }
+
+    // The format does not know its size before decoding.
+    p_originalWidth = image.width();
+    if (p_width > 0 && image.width() > p_width) {
+        image = image.scaledToWidth(p_width, Qt::SmoothTransformation);
+    }
+
+    return image;
+}
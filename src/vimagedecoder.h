@@ -0,0 +1,51 @@
+#ifndef VIMAGEDECODER_H
+#define VIMAGEDECODER_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QImage>
+
+class QThreadPool;
+class QIODevice;
+
+// Decode images on a thread pool, downscaled to the width they are shown at.
+class VImageDecoder : public QObject
+{
+    Q_OBJECT
+public:
+    explicit VImageDecoder(QObject *p_parent = 0);
+
+    // Wait for the decodes in progress. Queued ones are dropped.
+    ~VImageDecoder();
+
+    // Decode the image file @p_path asynchronously. It is downscaled to
+    // @p_width if it is wider. 0 to keep its size.
+    // If @p_useThumbnail, load it from VThumbnailCache if possible, and store
+    // the downscaled image there.
+    void decodeAsync(const QString &p_path, int p_width, bool p_useThumbnail = false);
+
+    // Decode the image in @p_data identified by @p_name, such as a downloaded
+    // one, asynchronously.
+    void decodeAsync(const QString &p_name, const QByteArray &p_data, int p_width);
+
+    // Decode the image from @p_device, downscaled to @p_width if it is wider.
+    // Only the scaled pixels are decoded if the format supports it.
+    // @p_originalWidth will be the width of the image before scaling.
+    static QImage decode(QIODevice *p_device, int p_width, int &p_originalWidth);
+
+signals:
+    // Emitted in the thread of the decoder object. @p_image is null if
+    // it fails. @p_width is the one requested.
+    void imageDecoded(const QString &p_name, int p_width,
+                      const QImage &p_image, int p_originalWidth);
+
+private:
+    QThreadPool *m_pool;
+
+    // Max number of threads of @m_pool. Decoding is mostly bound by memory
+    // bandwidth, so more threads do not help much.
+    static const int c_maxThreads;
+};
+
+#endif // VIMAGEDECODER_H
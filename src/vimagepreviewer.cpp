@@ -1,16 +1,22 @@
 #include "vimagepreviewer.h"
 
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QTextDocument>
 #include <QDebug>
 #include <QDir>
 #include <QUrl>
+#include <QPainter>
+#include <QScrollBar>
 #include "vmdedit.h"
 #include "vconfigmanager.h"
 #include "utils/vutils.h"
 #include "utils/veditutils.h"
 #include "vfile.h"
 #include "vdownloader.h"
+#include "vimagedecoder.h"
+#include "vimagecache.h"
+#include "vthumbnailcache.h"
 #include "hgmarkdownhighlighter.h"
 
 extern VConfigManager vconfig;
@@ -19,16 +25,28 @@ enum ImageProperty { ImagePath = 1 };
 
 const int VImagePreviewer::c_minImageWidth = 100;
 
-VImagePreviewer::VImagePreviewer(VMdEdit *p_edit, int p_timeToPreview)
+const int VImagePreviewer::c_redecodeRatio = 4;
+
+const int VImagePreviewer::c_lazyPreviewMargin = 30;
+
+const int VImagePreviewer::c_lazyRetireMargin = 150;
+
+const QString VImagePreviewer::c_placeholderName = "vnote-image-placeholder";
+
+VImagePreviewer::VImagePreviewer(VMdEdit *p_edit)
     : QObject(p_edit), m_edit(p_edit), m_document(p_edit->document()),
       m_file(p_edit->getFile()), m_enablePreview(true), m_isPreviewing(false),
       m_requestCearBlocks(false), m_requestRefreshBlocks(false),
-      m_updatePending(false), m_imageWidth(c_minImageWidth)
+      m_updatePending(false), m_imageWidth(c_minImageWidth),
+      m_previewDelay(vconfig.getMinPreviewImageDelay(), vconfig.getMaxPreviewImageDelay()),
+      m_fullPassRequired(true), m_dirtyStart(-1), m_dirtyEnd(-1),
+      m_firstVisibleBlock(-1), m_lastVisibleBlock(-1), m_windowFirst(-1),
+      m_windowLast(-1), m_previewedFirst(-1), m_previewedLast(-1),
+      m_visibleRangePending(false)
 {
     m_timer = new QTimer(this);
     m_timer->setSingleShot(true);
-    Q_ASSERT(p_timeToPreview > 0);
-    m_timer->setInterval(p_timeToPreview);
+    m_timer->setInterval(m_previewDelay.getDelay());
 
     connect(m_timer, &QTimer::timeout,
             this, &VImagePreviewer::timerTimeout);
@@ -37,10 +55,20 @@ VImagePreviewer::VImagePreviewer(VMdEdit *p_edit, int p_timeToPreview)
     connect(m_downloader, &VDownloader::downloadFinished,
             this, &VImagePreviewer::imageDownloaded);
 
+    VThumbnailCache::init();
+    m_decoder = new VImageDecoder(this);
+    connect(m_decoder, &VImageDecoder::imageDecoded,
+            this, &VImagePreviewer::imageDecoded);
+
     connect(m_edit->document(), &QTextDocument::contentsChange,
             this, &VImagePreviewer::handleContentChange);
 }
 
+const VAdaptiveDelay &VImagePreviewer::getPreviewDelay() const
+{
+    return m_previewDelay;
+}
+
 void VImagePreviewer::timerTimeout()
 {
     if (!vconfig.getEnablePreviewImages()) {
@@ -62,7 +90,7 @@ void VImagePreviewer::timerTimeout()
     previewImages();
 }
 
-void VImagePreviewer::handleContentChange(int /* p_position */,
+void VImagePreviewer::handleContentChange(int p_position,
                                           int p_charsRemoved,
                                           int p_charsAdded)
 {
@@ -70,6 +98,93 @@ void VImagePreviewer::handleContentChange(int /* p_position */,
         return;
     }
 
+    // Changes by the previewer itself are neither typing nor to be previewed.
+    if (m_isPreviewing) {
+        return;
+    }
+
+    m_previewDelay.recordInput();
+    markDirty(p_position, p_charsRemoved, p_charsAdded);
+
+    m_timer->stop();
+    m_timer->start(m_previewDelay.getDelay());
+}
+
+void VImagePreviewer::markDirty(int p_position, int p_charsRemoved, int p_charsAdded)
+{
+    int end = p_position + p_charsAdded;
+    if (m_dirtyStart == -1) {
+        m_dirtyStart = p_position;
+        m_dirtyEnd = end;
+        return;
+    }
+
+    // Shift the range by the change and cover the change.
+    if (m_dirtyEnd >= p_position + p_charsRemoved) {
+        m_dirtyEnd += p_charsAdded - p_charsRemoved;
+    }
+
+    m_dirtyStart = qMin(m_dirtyStart, p_position);
+    m_dirtyEnd = qMax(m_dirtyEnd, end);
+}
+
+void VImagePreviewer::addDirtyRange(int p_start, int p_end)
+{
+    if (m_dirtyStart == -1) {
+        m_dirtyStart = p_start;
+        m_dirtyEnd = p_end;
+        return;
+    }
+
+    m_dirtyStart = qMin(m_dirtyStart, p_start);
+    m_dirtyEnd = qMax(m_dirtyEnd, p_end);
+}
+
+void VImagePreviewer::markBlocksDirty(int p_first, int p_last)
+{
+    QTextCursor startCursor, endCursor;
+    blockRangeCursors(p_first, p_last, startCursor, endCursor);
+    addDirtyRange(startCursor.position(), endCursor.position());
+}
+
+void VImagePreviewer::blockRangeCursors(int p_first, int p_last,
+                                        QTextCursor &p_startCursor,
+                                        QTextCursor &p_endCursor)
+{
+    int maxBlock = m_document->blockCount() - 1;
+    p_startCursor = QTextCursor(m_document->findBlockByNumber(qBound(0, p_first, maxBlock)));
+    p_endCursor = QTextCursor(m_document->findBlockByNumber(qBound(0, p_last, maxBlock)));
+}
+
+void VImagePreviewer::setVisibleBlockRange(int p_first, int p_last)
+{
+    m_firstVisibleBlock = p_first;
+    m_lastVisibleBlock = p_last;
+
+    if (!vconfig.getEnableLazyImagePreview() || !m_enablePreview) {
+        return;
+    }
+
+    if (m_isPreviewing) {
+        // Blocks are being inserted. Check it after the pass.
+        m_visibleRangePending = true;
+        return;
+    }
+
+    // Preview more once half of the margin has been scrolled through.
+    int maxBlock = m_document->blockCount() - 1;
+    int half = c_lazyPreviewMargin / 2;
+    if (m_windowFirst > -1
+        && qMax(p_first - half, 0) >= m_windowFirst
+        && qMin(p_last + half, maxBlock) <= m_windowLast) {
+        return;
+    }
+
+    markBlocksDirty(p_first - c_lazyPreviewMargin, p_last + c_lazyPreviewMargin);
+    if (vconfig.getRetireFarImagePreviews() && m_previewedFirst > -1) {
+        markBlocksDirty(m_previewedFirst, m_previewedLast);
+    }
+
     m_timer->stop();
     m_timer->start();
 }
@@ -88,12 +203,68 @@ void VImagePreviewer::previewImages()
     // Get the width of the m_edit.
     m_imageWidth = qMax(m_edit->size().width() - 50, c_minImageWidth);
 
+    QElapsedTimer costTimer;
+    costTimer.start();
+
+    // An image link and its preview block are previewed together, so the
+    // blocks next to the changed ones are visited, too.
+    QTextBlock block;
+    QTextCursor endCursor;
+    if (m_fullPassRequired) {
+        block = m_document->begin();
+    } else if (m_dirtyStart != -1) {
+        block = m_document->findBlock(m_dirtyStart);
+        if (!block.isValid()) {
+            block = m_document->lastBlock();
+        } else if (block.previous().isValid()) {
+            block = block.previous();
+        }
+
+        QTextBlock lastBlock = m_document->findBlock(m_dirtyEnd);
+        if (lastBlock.isValid() && lastBlock.next().isValid()) {
+            // A cursor keeps its position through the changes of the pass.
+            endCursor = QTextCursor(lastBlock.next());
+        }
+    }
+
+    m_fullPassRequired = false;
+    m_dirtyStart = m_dirtyEnd = -1;
+
+    // With lazy preview, only the images within the window around the
+    // viewport are previewed, and the previews beyond the retire range are
+    // removed if retiring. The cursors keep their positions through the
+    // changes of the pass.
+    bool lazy = vconfig.getEnableLazyImagePreview();
+    bool retire = lazy && vconfig.getRetireFarImagePreviews();
+    QTextCursor windowStart, windowEnd, retireStart, retireEnd, anchor;
+    int anchorTop = 0;
+    if (lazy) {
+        int first = qMax(m_firstVisibleBlock, 0);
+        int last = qMax(m_lastVisibleBlock, first);
+        blockRangeCursors(first - c_lazyPreviewMargin, last + c_lazyPreviewMargin,
+                          windowStart, windowEnd);
+        blockRangeCursors(first - c_lazyRetireMargin, last + c_lazyRetireMargin,
+                          retireStart, retireEnd);
+
+        // Keep the visible text in place when blocks above it change.
+        anchor = m_edit->cursorForPosition(QPoint(0, 0));
+        anchorTop = m_edit->cursorRect(anchor).top();
+    }
+
+    int visitFirst = block.isValid() ? block.blockNumber() : -1;
+
     m_isPreviewing = true;
-    QTextBlock block = m_document->begin();
     while (block.isValid() && m_enablePreview) {
+        if (!endCursor.isNull() && block.position() > endCursor.position()) {
+            break;
+        }
+
         if (isImagePreviewBlock(block)) {
-            // Image preview block. Check if it is parentless.
-            if (!isValidImagePreviewBlock(block) || !isNormalBlock(block)) {
+            // Image preview block. Check if it is parentless or far away.
+            if (!isValidImagePreviewBlock(block)
+                || !isNormalBlock(block)
+                || (retire && (block.position() < retireStart.position()
+                               || block.position() > retireEnd.position()))) {
                 QTextBlock nblock = block.next();
                 removeBlock(block);
                 block = nblock;
@@ -103,7 +274,9 @@ void VImagePreviewer::previewImages()
         } else {
             clearCorruptedImagePreviewBlock(block);
 
-            if (isNormalBlock(block)) {
+            if (isNormalBlock(block)
+                && (!lazy || (block.position() >= windowStart.position()
+                              && block.position() <= windowEnd.position()))) {
                 block = previewImageOfOneBlock(block);
             } else {
                 block = block.next();
@@ -113,6 +286,36 @@ void VImagePreviewer::previewImages()
 
     m_isPreviewing = false;
 
+    if (lazy) {
+        m_windowFirst = windowStart.blockNumber();
+        m_windowLast = windowEnd.blockNumber();
+
+        // If retiring, previews of the blocks visited are within the retire
+        // range now. Those not visited are within the range recorded before.
+        bool coveredAll = visitFirst > -1
+                          && visitFirst <= m_previewedFirst
+                          && (endCursor.isNull() || endCursor.blockNumber() >= m_previewedLast);
+        if (m_previewedFirst == -1 || (retire && coveredAll)) {
+            m_previewedFirst = retire ? retireStart.blockNumber() : m_windowFirst;
+            m_previewedLast = retire ? retireEnd.blockNumber() : m_windowLast;
+        } else {
+            m_previewedFirst = qMin(m_previewedFirst, m_windowFirst);
+            m_previewedLast = qMax(m_previewedLast, m_windowLast);
+        }
+
+        int delta = m_edit->cursorRect(anchor).top() - anchorTop;
+        if (delta != 0) {
+            QScrollBar *scrollBar = m_edit->verticalScrollBar();
+            scrollBar->setValue(scrollBar->value() + delta);
+        }
+    } else {
+        m_windowFirst = m_windowLast = -1;
+        m_previewedFirst = m_previewedLast = -1;
+    }
+
+    m_previewDelay.recordCost(costTimer.elapsed());
+    m_timer->setInterval(m_previewDelay.getDelay());
+
     if (m_requestCearBlocks) {
         m_requestCearBlocks = false;
         clearAllImagePreviewBlocks();
@@ -129,6 +332,11 @@ void VImagePreviewer::previewImages()
         m_timer->start();
     }
 
+    if (m_visibleRangePending) {
+        m_visibleRangePending = false;
+        setVisibleBlockRange(m_firstVisibleBlock, m_lastVisibleBlock);
+    }
+
     emit m_edit->statusChanged();
 }
 
@@ -263,6 +471,10 @@ QTextBlock VImagePreviewer::insertImagePreviewBlock(QTextBlock &p_block,
 
     m_edit->setModified(modified);
 
+    if (imageName == c_placeholderName) {
+        m_placeholderBlocks.insert(p_imagePath, QTextCursor(cursor.block()));
+    }
+
     return cursor.block();
 }
 
@@ -274,7 +486,9 @@ void VImagePreviewer::updateImagePreviewBlock(QTextBlock &p_block,
     QString curPath = format.property(ImagePath).toString();
     QString imageName;
 
-    if (curPath == p_imagePath) {
+    if (curPath == p_imagePath && format.name() != c_placeholderName) {
+        redecodeIfNeeded(p_imagePath);
+
         if (updateImageWidth(format)) {
             goto update;
         }
@@ -282,7 +496,7 @@ void VImagePreviewer::updateImagePreviewBlock(QTextBlock &p_block,
         return;
     }
 
-    // Update it with the new image.
+    // Update it with the new image, or the decoded one of the placeholder.
     imageName = imageCacheResourceName(p_imagePath);
     if (imageName.isEmpty()) {
         // Delete current preview block.
@@ -290,10 +504,20 @@ void VImagePreviewer::updateImagePreviewBlock(QTextBlock &p_block,
         return;
     }
 
+    if (imageName == format.name()) {
+        // Still being decoded.
+        return;
+    }
+
     format.setName(imageName);
     format.setProperty(ImagePath, p_imagePath);
 
-    updateImageWidth(format);
+    if (imageName == c_placeholderName) {
+        format.clearProperty(QTextFormat::ImageWidth);
+        m_placeholderBlocks.insert(p_imagePath, QTextCursor(p_block));
+    } else {
+        updateImageWidth(format);
+    }
 
 update:
     updateFormatInPreviewBlock(p_block, format);
@@ -354,6 +578,7 @@ bool VImagePreviewer::isPreviewEnabled()
 void VImagePreviewer::enableImagePreview()
 {
     m_enablePreview = true;
+    m_fullPassRequired = true;
 
     if (vconfig.getEnablePreviewImages()) {
         m_timer->stop();
@@ -459,28 +684,122 @@ QString VImagePreviewer::imageCacheResourceName(const QString &p_imagePath)
         return it.value().m_name;
     }
 
-    // Add it to the resource cache even if it may exist there.
+    if (m_failedImages.contains(p_imagePath)) {
+        return QString();
+    }
+
+    if (m_pendingDecodes.contains(p_imagePath)) {
+        return placeholderResourceName();
+    }
+
+    // Decoded by another note or an earlier preview.
+    int width = decodeWidth();
+    VCachedImage image = VImageCache::get(p_imagePath, width);
+    if (!image.isNull()) {
+        return addImageResource(p_imagePath, width, image);
+    }
+
     QFileInfo info(p_imagePath);
-    QImage image;
     if (info.exists()) {
-        // Local file.
-        image = QImage(p_imagePath);
+        // Local file. Decode it off the GUI thread.
+        requestDecode(p_imagePath);
+        return placeholderResourceName();
     } else {
         // URL. Try to download it.
         m_downloader->download(p_imagePath);
     }
 
-    if (image.isNull()) {
-        return QString();
+    return QString();
+}
+
+int VImagePreviewer::decodeWidth() const
+{
+    if (!vconfig.getEnablePreviewImageConstraint()) {
+        return 0;
+    }
+
+    return m_imageWidth * m_edit->devicePixelRatio();
+}
+
+void VImagePreviewer::requestDecode(const QString &p_imagePath)
+{
+    int width = decodeWidth();
+    m_pendingDecodes.insert(p_imagePath, width);
+
+    // Thumbnails of previous sessions are loaded instead if available.
+    m_decoder->decodeAsync(p_imagePath, width, true);
+}
+
+void VImagePreviewer::redecodeIfNeeded(const QString &p_imagePath)
+{
+    auto it = m_imageCache.find(p_imagePath);
+    if (it == m_imageCache.end() || m_pendingDecodes.contains(p_imagePath)) {
+        return;
     }
 
+    // Widths in pixels of the image decoded and the one to decode.
+    const ImageInfo &info = it.value();
+    int decoded = info.m_width;
+    if (info.m_decodedWidth > 0) {
+        decoded = qMin(info.m_decodedWidth, info.m_width);
+    }
+
+    int width = decodeWidth();
+    int target = width > 0 ? qMin(width, info.m_width) : info.m_width;
+    if (qAbs(target - decoded) * c_redecodeRatio <= decoded) {
+        return;
+    }
+
+    VCachedImage image = VImageCache::get(p_imagePath, width);
+    if (!image.isNull()) {
+        addImageResource(p_imagePath, width, image);
+        return;
+    }
+
+    // Downloaded images are not kept to be decoded again.
+    if (QFileInfo(p_imagePath).exists()) {
+        requestDecode(p_imagePath);
+    }
+}
+
+QString VImagePreviewer::addImageResource(const QString &p_imagePath, int p_width,
+                                          const VCachedImage &p_image)
+{
     QString name(imagePathToCacheResourceName(p_imagePath));
-    m_document->addResource(QTextDocument::ImageResource, name, image);
-    m_imageCache.insert(p_imagePath, ImageInfo(name, image.width()));
+    m_document->addResource(QTextDocument::ImageResource, name, p_image.m_image);
+
+    auto it = m_imageCache.find(p_imagePath);
+    if (it == m_imageCache.end()) {
+        m_imageCache.insert(p_imagePath, ImageInfo(name, p_image.m_originalWidth, p_width));
+    } else {
+        // Decoded again at another width.
+        it.value().m_width = p_image.m_originalWidth;
+        it.value().m_decodedWidth = p_width;
+        m_edit->viewport()->update();
+    }
 
     return name;
 }
 
+QString VImagePreviewer::placeholderResourceName()
+{
+    static QImage placeholder;
+    if (placeholder.isNull()) {
+        placeholder = QImage(c_minImageWidth / 2, c_minImageWidth / 2, QImage::Format_ARGB32);
+        placeholder.fill(Qt::transparent);
+        QPainter painter(&placeholder);
+        painter.setPen(Qt::lightGray);
+        painter.drawRect(placeholder.rect().adjusted(0, 0, -1, -1));
+    }
+
+    // The resources of the document may have been cleared.
+    if (!m_document->resource(QTextDocument::ImageResource, c_placeholderName).isValid()) {
+        m_document->addResource(QTextDocument::ImageResource, c_placeholderName, placeholder);
+    }
+
+    return c_placeholderName;
+}
+
 QString VImagePreviewer::imagePathToCacheResourceName(const QString &p_imagePath)
 {
     return p_imagePath;
@@ -488,21 +807,62 @@ QString VImagePreviewer::imagePathToCacheResourceName(const QString &p_imagePath
 
 void VImagePreviewer::imageDownloaded(const QByteArray &p_data, const QString &p_url)
 {
-    QImage image(QImage::fromData(p_data));
+    if (p_data.isEmpty()
+        || m_imageCache.contains(p_url)
+        || m_pendingDecodes.contains(p_url)) {
+        return;
+    }
 
-    if (!image.isNull()) {
-        auto it = m_imageCache.find(p_url);
-        if (it != m_imageCache.end()) {
-            return;
+    int width = decodeWidth();
+    m_pendingDecodes.insert(p_url, width);
+    m_decoder->decodeAsync(p_url, p_data, width);
+}
+
+void VImagePreviewer::imageDecoded(const QString &p_name, int p_width,
+                                   const QImage &p_image, int p_originalWidth)
+{
+    auto pit = m_pendingDecodes.find(p_name);
+    if (pit == m_pendingDecodes.end() || pit.value() != p_width) {
+        // Outdated by a refresh or a newer decode.
+        return;
+    }
+
+    m_pendingDecodes.erase(pit);
+
+    // Preview the blocks of its placeholder again. The cursors follow the
+    // edits since, and fall onto a neighbour if a block has been removed.
+    const QList<QTextCursor> cursors = m_placeholderBlocks.values(p_name);
+    for (auto const & cursor : cursors) {
+        QTextBlock block = cursor.block();
+        if (block.isValid()) {
+            addDirtyRange(block.position(), block.position() + block.length() - 1);
         }
+    }
 
-        m_timer->stop();
-        QString name(imagePathToCacheResourceName(p_url));
-        m_document->addResource(QTextDocument::ImageResource, name, image);
-        m_imageCache.insert(p_url, ImageInfo(name, image.width()));
+    m_placeholderBlocks.remove(p_name);
+
+    bool isNew = !m_imageCache.contains(p_name);
+    if (p_image.isNull()) {
+        // Remove the placeholder at next preview.
+        if (!m_imageCache.contains(p_name)) {
+            m_failedImages.insert(p_name);
+        }
+    } else {
+        VCachedImage image(p_image, p_originalWidth);
+        VImageCache::insert(p_name, p_width, image);
+        addImageResource(p_name, p_width, image);
 
-        qDebug() << "downloaded image cache insert" << p_url << name;
+        qDebug() << "image cache insert" << p_name << p_width << p_image.size();
+    }
+
+    if (isNew && cursors.isEmpty()) {
+        // A downloaded image has no placeholder. Look for its links.
+        m_fullPassRequired = true;
+    }
 
+    // Swap the decoded image in for the placeholder.
+    if (isNew) {
+        m_timer->stop();
         m_timer->start();
     }
 }
@@ -516,7 +876,11 @@ void VImagePreviewer::refresh()
 
     m_timer->stop();
     m_imageCache.clear();
+    m_pendingDecodes.clear();
+    m_placeholderBlocks.clear();
+    m_failedImages.clear();
     clearAllImagePreviewBlocks();
+    m_fullPassRequired = true;
     m_timer->start();
 }
 
@@ -527,6 +891,13 @@ QImage VImagePreviewer::fetchCachedImageFromPreviewBlock(QTextBlock &p_block)
         return QImage();
     }
 
+    if (QFileInfo(path).exists()) {
+        QImage image(path);
+        if (!image.isNull()) {
+            return image;
+        }
+    }
+
     auto it = m_imageCache.find(path);
     if (it == m_imageCache.end()) {
         return QImage();
@@ -557,6 +928,7 @@ bool VImagePreviewer::updateImageWidth(QTextImageFormat &p_format)
 
 void VImagePreviewer::update()
 {
+    m_fullPassRequired = true;
     m_timer->stop();
     m_timer->start();
 }
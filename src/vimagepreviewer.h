@@ -4,19 +4,24 @@
 #include <QObject>
 #include <QString>
 #include <QTextBlock>
+#include <QTextCursor>
 #include <QHash>
+#include <QSet>
+#include "vadaptivedelay.h"
 
 class VMdEdit;
 class QTimer;
 class QTextDocument;
 class VFile;
 class VDownloader;
+class VImageDecoder;
+struct VCachedImage;
 
 class VImagePreviewer : public QObject
 {
     Q_OBJECT
 public:
-    explicit VImagePreviewer(VMdEdit *p_edit, int p_timeToPreview);
+    explicit VImagePreviewer(VMdEdit *p_edit);
 
     void disableImagePreview();
     void enableImagePreview();
@@ -24,32 +29,66 @@ public:
 
     bool isImagePreviewBlock(const QTextBlock &p_block);
 
+    // Fetch the image previewed in @p_block at its original size. The cached
+    // one may be downscaled.
     QImage fetchCachedImageFromPreviewBlock(QTextBlock &p_block);
 
     // Clear the m_imageCache and all the preview blocks.
-    // Then re-preview all the blocks.
+    // Then re-preview all the blocks. Images decoded by VImageCache are kept
+    // unless the files are modified.
     void refresh();
 
+    // Re-preview all the blocks, such as after a resize.
     void update();
 
+    // Delay before previewing after a change.
+    const VAdaptiveDelay &getPreviewDelay() const;
+
+    // Blocks [@p_first, @p_last] are visible in the viewport. With lazy
+    // preview, the images around them will be previewed.
+    void setVisibleBlockRange(int p_first, int p_last);
+
 private slots:
     void timerTimeout();
     void handleContentChange(int p_position, int p_charsRemoved, int p_charsAdded);
     void imageDownloaded(const QByteArray &p_data, const QString &p_url);
+    void imageDecoded(const QString &p_name, int p_width,
+                      const QImage &p_image, int p_originalWidth);
 
 private:
     struct ImageInfo
     {
-        ImageInfo(const QString &p_name, int p_width)
-            : m_name(p_name), m_width(p_width)
+        ImageInfo(const QString &p_name, int p_width, int p_decodedWidth)
+            : m_name(p_name), m_width(p_width), m_decodedWidth(p_decodedWidth)
         {
         }
 
         QString m_name;
+
+        // Original width of the image.
         int m_width;
+
+        // Width the image is decoded at. 0 for the original width.
+        int m_decodedWidth;
     };
 
+    // Preview the blocks changed since last time, or all of them if
+    // m_fullPassRequired.
     void previewImages();
+
+    // Record a change of the document to be previewed.
+    void markDirty(int p_position, int p_charsRemoved, int p_charsAdded);
+
+    // Add positions [@p_start, @p_end] to the range to be previewed.
+    void addDirtyRange(int p_start, int p_end);
+
+    // Record blocks [@p_first, @p_last] to be previewed.
+    void markBlocksDirty(int p_first, int p_last);
+
+    // Cursors at the first and last blocks of [@p_first, @p_last], clamped to
+    // the document.
+    void blockRangeCursors(int p_first, int p_last,
+                           QTextCursor &p_startCursor, QTextCursor &p_endCursor);
     bool isValidImagePreviewBlock(QTextBlock &p_block);
 
     // Fetch the image link's URL if there is only one link.
@@ -85,9 +124,28 @@ private:
                                     const QTextImageFormat &p_format);
 
     // Look up m_imageCache to get the resource name in QTextDocument's cache.
-    // If there is none, insert it.
+    // If there is none, request to decode it and return the name of the
+    // placeholder. Return empty if it could not be previewed.
     QString imageCacheResourceName(const QString &p_imagePath);
 
+    // Width to decode the images at, in device pixels. 0 for the original width.
+    int decodeWidth() const;
+
+    // Decode the local image @p_imagePath asynchronously.
+    void requestDecode(const QString &p_imagePath);
+
+    // Decode @p_imagePath again if the preview width has changed much since
+    // it was decoded.
+    void redecodeIfNeeded(const QString &p_imagePath);
+
+    // Add @p_image decoded at @p_width to the resources and m_imageCache.
+    // Return its resource name.
+    QString addImageResource(const QString &p_imagePath, int p_width,
+                             const VCachedImage &p_image);
+
+    // Add the placeholder image to the resources and return its name.
+    QString placeholderResourceName();
+
     QString imagePathToCacheResourceName(const QString &p_imagePath);
 
     // Return true if and only if there is update.
@@ -109,12 +167,66 @@ private:
     // Map from image full path to QUrl identifier in the QTextDocument's cache.
     QHash<QString, ImageInfo> m_imageCache;;
 
+    // Map from image full path to the width requested of the decode in
+    // progress. Results not matching it are outdated.
+    QHash<QString, int> m_pendingDecodes;
+
+    // Cursors at the blocks showing the placeholder of each image being
+    // decoded. Unlike QTextBlock, a cursor stays valid when its block is
+    // removed.
+    QMultiHash<QString, QTextCursor> m_placeholderBlocks;
+
+    // Images failed to decode.
+    QSet<QString> m_failedImages;
+
     VDownloader *m_downloader;
 
+    VImageDecoder *m_decoder;
+
     // The preview width.
     int m_imageWidth;
 
+    // Adapt the interval of m_timer to the cost of previewing.
+    VAdaptiveDelay m_previewDelay;
+
+    // Whether next preview should visit all the blocks.
+    bool m_fullPassRequired;
+
+    // Range of positions changed since last preview. -1 if none.
+    int m_dirtyStart;
+    int m_dirtyEnd;
+
+    // Range of blocks visible in the viewport. -1 if unknown.
+    int m_firstVisibleBlock;
+    int m_lastVisibleBlock;
+
+    // With lazy preview, range of blocks previewed by last pass. -1 if none.
+    int m_windowFirst;
+    int m_windowLast;
+
+    // With lazy preview, range of blocks which may have preview blocks, to be
+    // visited to retire the far ones. -1 if none.
+    int m_previewedFirst;
+    int m_previewedLast;
+
+    // The visible range changed during a pass.
+    bool m_visibleRangePending;
+
+    // Number of blocks around the visible ones to preview with lazy preview.
+    static const int c_lazyPreviewMargin;
+
+    // Number of blocks around the visible ones beyond which the previews are
+    // removed if retiring.
+    static const int c_lazyRetireMargin;
+
     static const int c_minImageWidth;
+
+    // Decode again if the preview width differs from the decoded one by more
+    // than 1 / c_redecodeRatio.
+    static const int c_redecodeRatio;
+
+    // Resource name of the image shown until the image is decoded.
+    static const QString c_placeholderName;
 };
 
 #endif // VIMAGEPREVIEWER_H
@@ -23,6 +23,8 @@
 #include "vvimindicator.h"
 #include "vtabindicator.h"
 #include "dialog/vupdater.h"
+#include "vpegparser.h"
+#include "vcodeblockhighlighthelper.h"
 
 extern VConfigManager vconfig;
 
@@ -399,6 +401,11 @@ void VMainWindow::initHelpMenu()
     connect(shortcutAct, &QAction::triggered,
             this, &VMainWindow::shortcutHelp);
 
+    QAction *perfAct = new QAction(tr("&Performance Statistics"), this);
+    perfAct->setToolTip(tr("View the adaptive delays and counters of the editor"));
+    connect(perfAct, &QAction::triggered,
+            this, &VMainWindow::perfStats);
+
     QAction *updateAct = new QAction(tr("Check For &Updates"), this);
     updateAct->setToolTip(tr("Check for updates of VNote"));
     connect(updateAct, &QAction::triggered,
@@ -440,6 +447,7 @@ void VMainWindow::initHelpMenu()
 #endif
 
     helpMenu->addAction(shortcutAct);
+    helpMenu->addAction(perfAct);
     helpMenu->addAction(updateAct);
     helpMenu->addAction(starAct);
     helpMenu->addAction(feedbackAct);
@@ -1599,6 +1607,23 @@ void VMainWindow::shortcutHelp()
     editArea->openFile(file, OpenFileMode::Read);
 }
 
+void VMainWindow::perfStats()
+{
+    QStringList stats;
+    VMdTab *mdTab = dynamic_cast<VMdTab *>((VEditTab *)m_curTab);
+    if (mdTab && mdTab->isEditMode()) {
+        stats << tr("Current note:") << mdTab->getPerfStats() << QString();
+    }
+
+    stats << tr("Cancelled parses: %1").arg(VPegParser::getNumOfCancelledParses());
+    stats << tr("Parses over time budget: %1").arg(VPegParser::getNumOfOverBudgetParses());
+    stats << tr("Code block cache hits: %1, misses: %2")
+               .arg(VCodeBlockHighlightHelper::getNumOfCacheHits())
+               .arg(VCodeBlockHighlightHelper::getNumOfCacheMisses());
+
+    QMessageBox::information(this, tr("Performance Statistics"), stats.join('\n'));
+}
+
 void VMainWindow::printNote()
 {
     QPrinter printer;
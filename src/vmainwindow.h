@@ -50,6 +50,9 @@ private slots:
     void changeMarkdownConverter(QAction *action);
     void aboutMessage();
     void shortcutHelp();
+
+    // Show the performance statistics of the editor.
+    void perfStats();
     void changeExpandTab(bool checked);
     void setTabStopWidth(QAction *action);
     void setEditorBackgroundColor(QAction *action);
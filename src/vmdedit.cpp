@@ -9,6 +9,7 @@
 #include "utils/vutils.h"
 #include "dialog/vselectdialog.h"
 #include "vimagepreviewer.h"
+#include "vimagecache.h"
 
 extern VConfigManager vconfig;
 extern VNote *g_vnote;
@@ -21,8 +22,8 @@ VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
 
     setAcceptRichText(false);
     m_mdHighlighter = new HGMarkdownHighlighter(vconfig.getMdHighlightingStyles(),
-                                                vconfig.getCodeBlockStyles(),
-                                                700, document());
+                                                vconfig.getCodeBlockFormats(),
+                                                document());
     connect(m_mdHighlighter, &HGMarkdownHighlighter::highlightCompleted,
             this, &VMdEdit::generateEditOutline);
 
@@ -47,7 +48,11 @@ VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
     m_cbHighlighter = new VCodeBlockHighlightHelper(m_mdHighlighter, p_vdoc,
                                                     p_type);
 
-    m_imagePreviewer = new VImagePreviewer(this, 500);
+    m_imagePreviewer = new VImagePreviewer(this);
+
+    // Preview blocks are not allowed in code blocks and comments.
+    connect(m_mdHighlighter, &HGMarkdownHighlighter::blockStatesChanged,
+            m_imagePreviewer, &VImagePreviewer::update);
 
     m_editOps = new VMdEditOperations(this, m_file);
 
@@ -59,6 +64,9 @@ VMdEdit::VMdEdit(VFile *p_file, VDocument *p_vdoc, MarkdownConverterType p_type,
     connect(this, &VMdEdit::cursorPositionChanged,
             this, &VMdEdit::updateCurHeader);
 
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &VMdEdit::updateVisibleBlocks);
+
     connect(this, &VMdEdit::selectionChanged,
             this, &VMdEdit::handleSelectionChanged);
     connect(QApplication::clipboard(), &QClipboard::changed,
@@ -461,6 +469,17 @@ void VMdEdit::resizeEvent(QResizeEvent *p_event)
     m_imagePreviewer->update();
 
     VEdit::resizeEvent(p_event);
+
+    updateVisibleBlocks();
+}
+
+void VMdEdit::updateVisibleBlocks()
+{
+    QRect rect = viewport()->rect();
+    int first = cursorForPosition(rect.topLeft()).block().blockNumber();
+    int last = cursorForPosition(rect.bottomRight()).block().blockNumber();
+    m_mdHighlighter->setVisibleBlockRange(first, last);
+    m_imagePreviewer->setVisibleBlockRange(first, last);
 }
 
 const QVector<VHeader> &VMdEdit::getHeaders() const
@@ -555,3 +574,31 @@ bool VMdEdit::jumpTitle(bool p_forward, int p_relativeLevel, int p_repeat)
 
     return false;
 }
+
+static QString delayStats(const QString &p_name, const VAdaptiveDelay &p_delay)
+{
+    return VMdEdit::tr("%1 delay: %2 ms (cost %3 ms, typing interval %4 ms, bounds %5-%6 ms)")
+                      .arg(p_name)
+                      .arg(p_delay.getDelay())
+                      .arg(p_delay.getAverageCost())
+                      .arg(p_delay.getTypingInterval())
+                      .arg(p_delay.getMinDelay())
+                      .arg(p_delay.getMaxDelay());
+}
+
+QString VMdEdit::getPerfStats() const
+{
+    QStringList stats;
+    stats << delayStats(tr("Highlight"), m_mdHighlighter->getParseDelay());
+    stats << delayStats(tr("Outline"), m_mdHighlighter->getCompleteDelay());
+    stats << delayStats(tr("Image preview"), m_imagePreviewer->getPreviewDelay());
+    stats << tr("Highlights take %1 bytes, saving %2 bytes")
+               .arg(m_mdHighlighter->getHighlightMemoryUsage())
+               .arg(m_mdHighlighter->getHighlightMemorySaved());
+    stats << tr("Image cache: %1 hits, %2 misses, %3 evictions, %4 bytes resident")
+               .arg(VImageCache::getNumOfHits())
+               .arg(VImageCache::getNumOfMisses())
+               .arg(VImageCache::getNumOfEvictions())
+               .arg(VImageCache::getResidentBytes());
+    return stats.join('\n');
+}
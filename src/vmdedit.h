@@ -39,6 +39,10 @@ public:
 
     const QVector<VHeader> &getHeaders() const;
 
+    // Adaptive delays and memory usage of the highlights of this note, one
+    // item per line. -1 means unknown.
+    QString getPerfStats() const;
+
 public slots:
     bool jumpTitle(bool p_forward, int p_relativeLevel, int p_repeat) Q_DECL_OVERRIDE;
 
@@ -61,6 +65,10 @@ private slots:
     void handleSelectionChanged();
     void handleClipboardChanged(QClipboard::Mode p_mode);
 
+    // Tell the highlighter and the image previewer the blocks visible in the
+    // viewport.
+    void updateVisibleBlocks();
+
 protected:
     void keyPressEvent(QKeyEvent *event) Q_DECL_OVERRIDE;
     bool canInsertFromMimeData(const QMimeData *source) const Q_DECL_OVERRIDE;
@@ -21,6 +21,7 @@
 #include "vfile.h"
 #include "vmdedit.h"
 #include "vconfigmanager.h"
+#include "vimagecache.h"
 #include "utils/vvim.h"
 #include "utils/veditutils.h"
 
@@ -139,7 +140,8 @@ bool VMdEditOperations::insertImageFromURL(const QUrl &imageUrl)
     // Whether it is a local file or web URL
     if (isLocal) {
         imagePath = imageUrl.toLocalFile();
-        image = QImage(imagePath);
+        // Decoded for the preview of the dialog only.
+        image = VImageCache::load(imagePath, VInsertImageDialog::c_previewWidth).m_image;
 
         if (image.isNull()) {
             qWarning() << "image is null";
@@ -633,6 +633,15 @@ VWebView *VMdTab::getWebViewer() const
     return m_webViewer;
 }
 
+QString VMdTab::getPerfStats() const
+{
+    if (!m_editor) {
+        return QString();
+    }
+
+    return dynamic_cast<VMdEdit *>(m_editor)->getPerfStats();
+}
+
 MarkdownConverterType VMdTab::getMarkdownConverterType() const
 {
     return m_mdConType;
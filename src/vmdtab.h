@@ -55,6 +55,9 @@ public:
 
     MarkdownConverterType getMarkdownConverterType() const;
 
+    // Performance statistics of the editor. Empty if it is not editable.
+    QString getPerfStats() const;
+
     void requestUpdateVimStatus() Q_DECL_OVERRIDE;
 
     // Insert decoration markers or decorate selected text.
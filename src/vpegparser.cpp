@@ -0,0 +1,361 @@
+#include "vpegparser.h"
+
+#include <QDebug>
+#include <algorithm>
+
+QAtomicInt VPegParser::s_numOfCancelledParses;
+
+QAtomicInt VPegParser::s_numOfOverBudgetParses;
+
+VPegParser::VPegParser(const QVector<HighlightingStyle> &p_styles, QObject *p_parent)
+    : QThread(p_parent), m_busy(false), m_cancelFlag(0), m_hasPendingConfig(false)
+{
+    m_arena = pmh_arena_new();
+
+    m_styleTypes.reserve(p_styles.size());
+    for (auto const & style : p_styles) {
+        m_styleTypes.append(style.type);
+    }
+
+    connect(this, &QThread::finished,
+            this, &VPegParser::handleFinished);
+}
+
+VPegParser::~VPegParser()
+{
+    m_cancelFlag.storeRelease(1);
+    wait();
+    pmh_arena_free(m_arena);
+}
+
+void VPegParser::parseAsync(const VPegParseConfig &p_config)
+{
+    if (m_busy) {
+        m_pendingConfig = p_config;
+        m_hasPendingConfig = true;
+        m_cancelFlag.storeRelease(1);
+        return;
+    }
+
+    m_busy = true;
+    m_cancelFlag.storeRelease(0);
+    m_config = p_config;
+    start();
+}
+
+void VPegParser::handleFinished()
+{
+    Q_ASSERT(m_busy);
+    m_busy = false;
+
+    // Release the snapshot.
+    m_config = VPegParseConfig();
+
+    if (m_hasPendingConfig) {
+        m_hasPendingConfig = false;
+        m_busy = true;
+        m_cancelFlag.storeRelease(0);
+        m_config = m_pendingConfig;
+        m_pendingConfig = VPegParseConfig();
+        start();
+
+        // The pending one is newer. No need to deliver current result.
+        m_result = VPegParseResult();
+        return;
+    }
+
+    VPegParseResult result = m_result;
+    m_result = VPegParseResult();
+    emit parseResultReady(result);
+}
+
+int VPegParser::pollCancelFlag(void *p_flag)
+{
+    return static_cast<QAtomicInt *>(p_flag)->loadAcquire();
+}
+
+void VPegParser::run()
+{
+    m_result = VPegParseResult();
+    m_result.m_timeStamp = m_config.m_timeStamp;
+    m_result.m_fullParse = m_config.m_fullParse;
+    m_result.m_startBlock = m_config.m_startBlock;
+    m_result.m_numOfOldBlocks = m_config.m_numOfOldBlocks;
+    m_result.m_blocksHighlights.appendBlocks(m_config.m_blockPositions.size());
+
+    if (m_config.m_text.isEmpty()) {
+        return;
+    }
+
+    preformatText();
+
+    pmh_preformatted_input input;
+    input.charbuf = m_charBuffer.data();
+    input.utf16 = m_config.m_text.utf16();
+    input.astral_positions = m_astralPositions.constData();
+    input.astral_positions_len = m_astralPositions.size();
+
+    pmh_element **elements = NULL;
+    m_result.m_status = pmh_preformatted_to_elements(&input,
+                                                     m_config.m_extensions,
+                                                     &elements,
+                                                     m_arena,
+                                                     &VPegParser::pollCancelFlag,
+                                                     &m_cancelFlag,
+                                                     m_config.m_timeBudget);
+    if (m_result.m_status == pmh_PARSE_CANCELLED) {
+        s_numOfCancelledParses.ref();
+        return;
+    } else if (m_result.m_status == pmh_PARSE_TIMEOUT) {
+        s_numOfOverBudgetParses.ref();
+        qWarning() << "parser: abandon parse of" << m_config.m_text.size()
+                   << "characters exceeding time budget" << m_config.m_timeBudget << "ms";
+        return;
+    }
+
+    if (!elements) {
+        return;
+    }
+
+    initBlockHighlightsFromResult(elements);
+
+    if (m_config.m_fullParse) {
+        initRegionsFromResult(elements);
+        initReferenceDefsFromResult(elements);
+    } else {
+        // New HTML blocks or comments will change the structure.
+        m_result.m_structureChanged = elements[pmh_COMMENT] || elements[pmh_HTMLBLOCK];
+    }
+
+    pmh_free_elements(elements);
+}
+
+// Head of the remaining elements of one style in the merge.
+struct ElementCursor
+{
+    pmh_element *m_elem;
+    int m_styleIndex;
+};
+
+// For a min-heap ordered by position, then by style index.
+static bool elementCursorGreater(const ElementCursor &p_a, const ElementCursor &p_b)
+{
+    if (p_a.m_elem->pos != p_b.m_elem->pos) {
+        return p_a.m_elem->pos > p_b.m_elem->pos;
+    }
+
+    return p_a.m_styleIndex > p_b.m_styleIndex;
+}
+
+static bool unitStyleLess(const HLUnit &p_a, const HLUnit &p_b)
+{
+    return p_a.styleIndex < p_b.styleIndex;
+}
+
+void VPegParser::initBlockHighlightsFromResult(pmh_element **p_elements)
+{
+    const QVector<int> &blockPos = m_config.m_blockPositions;
+    int nrBlocks = blockPos.size();
+    if (nrBlocks == 0) {
+        return;
+    }
+
+    // Merge the sorted lists of all styles into one stream sorted by position,
+    // which is swept once along with the block positions.
+    pmh_sort_elements_by_pos(p_elements);
+
+    QVector<ElementCursor> heap;
+    heap.reserve(m_styleTypes.size());
+    for (int styleIdx = 0; styleIdx < m_styleTypes.size(); ++styleIdx) {
+        pmh_element *elem = p_elements[m_styleTypes[styleIdx]];
+        if (elem) {
+            heap.append(ElementCursor{elem, styleIdx});
+        }
+    }
+
+    std::make_heap(heap.begin(), heap.end(), elementCursorGreater);
+
+    // Reuse the capacity.
+    m_blockUnits.resize(0);
+    m_unitCounts.fill(0, nrBlocks);
+
+    int length = m_config.m_length;
+    int blockIdx = 0;
+    while (!heap.isEmpty()) {
+        std::pop_heap(heap.begin(), heap.end(), elementCursorGreater);
+        ElementCursor &cursor = heap.last();
+        pmh_element *elem = cursor.m_elem;
+        int styleIdx = cursor.m_styleIndex;
+        if (elem->next) {
+            cursor.m_elem = elem->next;
+            std::push_heap(heap.begin(), heap.end(), elementCursorGreater);
+        } else {
+            heap.removeLast();
+        }
+
+        // elem->pos and elem->end is the start and end position of the
+        // element in the snapshot, in code points.
+        if (elem->end <= elem->pos) {
+            continue;
+        }
+
+        int pos = toUtf16Offset(elem->pos);
+        if (pos >= length) {
+            // All the remaining elements are beyond the blocks.
+            break;
+        }
+
+        int end = qMin(toUtf16Offset(elem->end), length);
+
+        // @pos never decreases, so neither does the block containing it.
+        while (blockIdx + 1 < nrBlocks && blockPos[blockIdx + 1] <= pos) {
+            ++blockIdx;
+        }
+
+        for (int i = blockIdx; i < nrBlocks; ++i) {
+            int blockStart = blockPos[i];
+            if (blockStart >= end) {
+                break;
+            }
+
+            // Including the trailing new line.
+            int blockEnd = (i + 1 < nrBlocks) ? blockPos[i + 1] : length + 1;
+            BlockUnit bu;
+            bu.m_block = i;
+            bu.m_unit.start = qMax(pos, blockStart) - blockStart;
+            bu.m_unit.length = qMin(end, blockEnd) - blockStart - bu.m_unit.start;
+            bu.m_unit.styleIndex = styleIdx;
+            m_blockUnits.append(bu);
+            ++m_unitCounts[i];
+        }
+    }
+
+    // Group the units by block in one contiguous array, keeping their order
+    // within each block.
+    VBlockHighlights<HLUnit> &highlights = m_result.m_blocksHighlights;
+    highlights.setUnitCounts(m_unitCounts);
+    m_unitCounts.fill(0);
+
+    for (auto const & bu : m_blockUnits) {
+        *(highlights.begin(bu.m_block) + m_unitCounts[bu.m_block]++) = bu.m_unit;
+    }
+
+    // Units of later styles override earlier ones within a block.
+    for (int i = 0; i < nrBlocks; ++i) {
+        if (m_unitCounts[i] > 1) {
+            std::stable_sort(highlights.begin(i), highlights.end(i), unitStyleLess);
+        }
+    }
+}
+
+void VPegParser::initRegionsFromResult(pmh_element **p_elements)
+{
+    int offset = m_config.m_offset;
+    pmh_element *elem = p_elements[pmh_COMMENT];
+    for (; elem != NULL; elem = elem->next) {
+        if (elem->end > elem->pos) {
+            m_result.m_commentRegions.push_back(VCommentRegion(toUtf16Offset(elem->pos) + offset,
+                                                               toUtf16Offset(elem->end) + offset));
+        }
+    }
+
+    elem = p_elements[pmh_HTMLBLOCK];
+    for (; elem != NULL; elem = elem->next) {
+        if (elem->end > elem->pos) {
+            m_result.m_htmlBlockRegions.push_back(VCommentRegion(toUtf16Offset(elem->pos) + offset,
+                                                                 toUtf16Offset(elem->end) + offset));
+        }
+    }
+
+    VCommentRegion::sortAndMerge(m_result.m_commentRegions);
+    VCommentRegion::sortAndMerge(m_result.m_htmlBlockRegions);
+
+    qDebug() << "parser:" << m_result.m_commentRegions.size() << "HTML comment regions";
+}
+
+void VPegParser::initReferenceDefsFromResult(pmh_element **p_elements)
+{
+    pmh_element *elem = p_elements[pmh_REFERENCE];
+    if (!elem) {
+        return;
+    }
+
+    for (; elem != NULL; elem = elem->next) {
+        if (elem->end > elem->pos) {
+            int pos = toUtf16Offset(elem->pos);
+            m_result.m_referenceDefs += m_config.m_text.mid(pos, toUtf16Offset(elem->end) - pos);
+            m_result.m_referenceDefs += "\n\n";
+        }
+    }
+}
+
+int VPegParser::getNumOfCancelledParses()
+{
+    return s_numOfCancelledParses.load();
+}
+
+int VPegParser::getNumOfOverBudgetParses()
+{
+    return s_numOfOverBudgetParses.load();
+}
+
+void VPegParser::preformatText()
+{
+    const QString &text = m_config.m_text;
+    int size = text.size();
+
+    // Each UTF-16 unit results in at most one byte, plus "\n\n\0".
+    // Reserve to keep the capacity when resizing.
+    if (m_charBuffer.capacity() < size + 3) {
+        m_charBuffer.reserve(size + 3);
+    }
+
+    m_charBuffer.resize(size + 3);
+    m_astralPositions.resize(0);
+
+    const ushort *src = text.utf16();
+    char *dst = m_charBuffer.data();
+    unsigned long pos = 0;
+    for (int i = 0; i < size; ++i) {
+        ushort ch = src[i];
+        char byte;
+        if (ch < 0x80) {
+            // Keep the parser from stopping at a null character.
+            byte = ch == 0 ? ' ' : ch;
+        } else if (ch == QChar::Nbsp) {
+            byte = ' ';
+        } else if (ch == QChar::LineSeparator) {
+            byte = '\n';
+        } else if (QChar::isHighSurrogate(ch)
+                   && i + 1 < size
+                   && QChar::isLowSurrogate(src[i + 1])) {
+            // Leading byte of the UTF-8 encoding of the code point.
+            uint ucs4 = QChar::surrogateToUcs4(ch, src[i + 1]);
+            byte = 0xF0 | (ucs4 >> 18);
+            m_astralPositions.append(pos);
+            ++i;
+        } else if (ch < 0x800) {
+            byte = 0xC0 | (ch >> 6);
+        } else {
+            byte = 0xE0 | (ch >> 12);
+        }
+
+        dst[pos++] = byte;
+    }
+
+    dst[pos++] = '\n';
+    dst[pos++] = '\n';
+    dst[pos] = '\0';
+}
+
+int VPegParser::toUtf16Offset(unsigned long p_pos) const
+{
+    if (m_astralPositions.isEmpty()) {
+        return p_pos;
+    }
+
+    // Each code point outside the BMP before @p_pos takes one more unit.
+    int nr = std::lower_bound(m_astralPositions.begin(), m_astralPositions.end(), p_pos)
+             - m_astralPositions.begin();
+    return p_pos + nr;
+}
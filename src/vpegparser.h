@@ -0,0 +1,184 @@
+#ifndef VPEGPARSER_H
+#define VPEGPARSER_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QVector>
+#include <QString>
+#include "hgmarkdownhighlighter.h"
+#include "vblockhighlights.h"
+
+// Config of one parse of an immutable snapshot of the document.
+struct VPegParseConfig
+{
+    VPegParseConfig()
+        : m_timeStamp(0), m_fullParse(true), m_offset(0), m_length(0),
+          m_startBlock(0), m_numOfOldBlocks(0), m_extensions(pmh_EXT_NONE),
+          m_timeBudget(0)
+    {
+    }
+
+    // Revision of the document when the snapshot was taken.
+    int m_timeStamp;
+
+    // Whether it is a parse of the whole document.
+    bool m_fullParse;
+
+    // Text to parse.
+    QString m_text;
+
+    // Position in document of the start of @m_text.
+    int m_offset;
+
+    // Length of the text of the blocks in @m_text. Text beyond it (such as
+    // the appended reference definitions) is only used as context.
+    int m_length;
+
+    // Position of each block covered by @m_text, relative to @m_offset.
+    QVector<int> m_blockPositions;
+
+    // Block number of the first block covered by @m_text.
+    int m_startBlock;
+
+    // Number of blocks in the highlighter to be replaced by the result.
+    int m_numOfOldBlocks;
+
+    // Bitfield of pmh_extensions.
+    int m_extensions;
+
+    // Abandon the parse if it takes longer than @m_timeBudget ms. 0 for no limit.
+    unsigned long m_timeBudget;
+};
+
+// Result of one parse.
+struct VPegParseResult
+{
+    VPegParseResult()
+        : m_timeStamp(0), m_status(pmh_PARSE_OK), m_fullParse(true),
+          m_startBlock(0), m_numOfOldBlocks(0), m_structureChanged(false)
+    {
+    }
+
+    int m_timeStamp;
+
+    // A pmh_parse_status value. The result is empty if it is not pmh_PARSE_OK.
+    int m_status;
+
+    bool m_fullParse;
+
+    int m_startBlock;
+
+    int m_numOfOldBlocks;
+
+    // Highlights of each block covered by the snapshot.
+    VBlockHighlights<HLUnit> m_blocksHighlights;
+
+    // Only valid for a full parse.
+    QVector<VCommentRegion> m_commentRegions;
+
+    QVector<VCommentRegion> m_htmlBlockRegions;
+
+    QString m_referenceDefs;
+
+    // For an incremental parse, whether there are elements which may change
+    // the structure of the document, such as HTML comments.
+    bool m_structureChanged;
+};
+
+// Run pmh_markdown_to_elements() on a worker thread.
+class VPegParser : public QThread
+{
+    Q_OBJECT
+public:
+    VPegParser(const QVector<HighlightingStyle> &p_styles, QObject *p_parent = 0);
+
+    ~VPegParser();
+
+    // Parse @p_config asynchronously. If it is busy now, current parse will
+    // be cancelled and @p_config will be parsed after it stops, replacing any
+    // previous pending one.
+    void parseAsync(const VPegParseConfig &p_config);
+
+    // Number of parses cancelled by a newer one in this process.
+    static int getNumOfCancelledParses();
+
+    // Number of parses exceeding their time budget in this process.
+    static int getNumOfOverBudgetParses();
+
+signals:
+    // Emitted in the thread of the parser object.
+    void parseResultReady(const VPegParseResult &p_result);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private slots:
+    void handleFinished();
+
+private:
+    void initBlockHighlightsFromResult(pmh_element **p_elements);
+
+    void initRegionsFromResult(pmh_element **p_elements);
+
+    void initReferenceDefsFromResult(pmh_element **p_elements);
+
+    // Transcode @m_config.m_text into @m_charBuffer in one pass.
+    void preformatText();
+
+    // Map an offset in code points returned by the parser to the offset
+    // in UTF-16 units of @m_config.m_text.
+    int toUtf16Offset(unsigned long p_pos) const;
+
+    // A unit with the index of the block it belongs to.
+    struct BlockUnit
+    {
+        int m_block;
+        HLUnit m_unit;
+    };
+
+    // Type of each highlighting style.
+    QVector<pmh_element_type> m_styleTypes;
+
+    VPegParseConfig m_config;
+
+    VPegParseResult m_result;
+
+    // Whether the thread is running or its result has not been handled.
+    bool m_busy;
+
+    // Set to cancel current parse. Written on the GUI thread and polled by
+    // the parse via pollCancelFlag().
+    QAtomicInt m_cancelFlag;
+
+    // Memory of the elements of each parse, reused across parses.
+    pmh_arena *m_arena;
+
+    // Parser input of @m_config.m_text, one byte per code point. Reused
+    // across parses.
+    QByteArray m_charBuffer;
+
+    // Offsets in code points of the code points outside the BMP, which take
+    // two UTF-16 units in @m_config.m_text.
+    QVector<unsigned long> m_astralPositions;
+
+    // Units in the order produced by the merge, before being grouped by
+    // block. Reused across parses.
+    QVector<BlockUnit> m_blockUnits;
+
+    // Number of units of each block. Reused across parses.
+    QVector<int> m_unitCounts;
+
+    bool m_hasPendingConfig;
+
+    VPegParseConfig m_pendingConfig;
+
+    // Cancel callback of the parser. @p_flag is the QAtomicInt to poll.
+    static int pollCancelFlag(void *p_flag);
+
+    static QAtomicInt s_numOfCancelledParses;
+
+    static QAtomicInt s_numOfOverBudgetParses;
+};
+
+#endif // VPEGPARSER_H
@@ -0,0 +1,56 @@
+#ifndef VTEXTBLOCKDATA_H
+#define VTEXTBLOCKDATA_H
+
+#include <QTextBlockUserData>
+#include <QString>
+
+// User data of a block of the markdown document, owned by the block.
+class VTextBlockData : public QTextBlockUserData
+{
+public:
+    VTextBlockData() : m_highlightHash(0), m_codeBlockIndent(-1) {}
+
+    uint getHighlightHash() const
+    {
+        return m_highlightHash;
+    }
+
+    void setHighlightHash(uint p_hash)
+    {
+        m_highlightHash = p_hash;
+    }
+
+    int getCodeBlockIndent() const
+    {
+        return m_codeBlockIndent;
+    }
+
+    void setCodeBlockIndent(int p_indent)
+    {
+        m_codeBlockIndent = p_indent;
+    }
+
+    const QString &getCodeBlockLang() const
+    {
+        return m_codeBlockLang;
+    }
+
+    void setCodeBlockLang(const QString &p_lang)
+    {
+        m_codeBlockLang = p_lang;
+    }
+
+private:
+    // Hash of the highlights the block was last formatted with, to tell
+    // whether it needs to be re-formatted after a parse.
+    uint m_highlightHash;
+
+    // Leading spaces of the opening fence of the fenced code block this
+    // block belongs to. -1 if it is not in a fenced code block.
+    int m_codeBlockIndent;
+
+    // Language of the fenced code block. Only set for the opening fence.
+    QString m_codeBlockLang;
+};
+
+#endif // VTEXTBLOCKDATA_H
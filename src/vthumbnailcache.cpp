@@ -0,0 +1,171 @@
+#include "vthumbnailcache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QDebug>
+#include "vconfigmanager.h"
+
+extern VConfigManager vconfig;
+
+QMutex VThumbnailCache::s_mutex;
+
+QString VThumbnailCache::s_folder;
+
+qint64 VThumbnailCache::s_budget = 0;
+
+qint64 VThumbnailCache::s_totalSize = -1;
+
+const qreal VThumbnailCache::c_gcRatio = 0.75;
+
+// "VTHB".
+const quint32 VThumbnailCache::c_magic = 0x56544842;
+
+const char *VThumbnailCache::c_suffix = ".vthumb";
+
+void VThumbnailCache::init()
+{
+    QMutexLocker locker(&s_mutex);
+    if (!s_folder.isEmpty()) {
+        return;
+    }
+
+    s_folder = VConfigManager::getThumbnailFolder();
+    s_budget = qMax(vconfig.getThumbnailCacheSize(), 0) * 1024LL * 1024LL;
+}
+
+bool VThumbnailCache::isEnabled()
+{
+    return s_budget > 0 && !s_folder.isEmpty();
+}
+
+QString VThumbnailCache::thumbnailPath(const QString &p_path, int p_width)
+{
+    QFileInfo info(p_path);
+    QString path = info.canonicalFilePath();
+    if (path.isEmpty()) {
+        return QString();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(path.toUtf8());
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    hash.addData(QByteArray::number(p_width));
+
+    return QDir(s_folder).filePath(QString::fromLatin1(hash.result().toHex()) + c_suffix);
+}
+
+QImage VThumbnailCache::load(const QString &p_path, int p_width, int &p_originalWidth)
+{
+    if (!isEnabled() || p_width <= 0) {
+        return QImage();
+    }
+
+    QFile file(thumbnailPath(p_path, p_width));
+    if (file.fileName().isEmpty() || !file.open(QIODevice::ReadOnly)) {
+        return QImage();
+    }
+
+    QDataStream in(&file);
+    quint32 magic = 0;
+    qint32 originalWidth = 0, width = 0, height = 0, format = 0;
+    QByteArray data;
+    in >> magic >> originalWidth >> width >> height >> format >> data;
+    if (in.status() != QDataStream::Ok
+        || magic != c_magic
+        || width <= 0
+        || height <= 0
+        || format <= QImage::Format_Invalid
+        || format >= QImage::NImageFormats) {
+        return QImage();
+    }
+
+    data = qUncompress(data);
+    QImage image(width, height, static_cast<QImage::Format>(format));
+    if (image.isNull() || data.size() != image.byteCount()) {
+        qWarning() << "invalid thumbnail" << file.fileName();
+        return QImage();
+    }
+
+    memcpy(image.bits(), data.constData(), data.size());
+    p_originalWidth = originalWidth;
+    return image;
+}
+
+void VThumbnailCache::store(const QString &p_path, int p_width,
+                            const QImage &p_image, int p_originalWidth)
+{
+    if (!isEnabled() || p_width <= 0 || p_image.isNull()) {
+        return;
+    }
+
+    QString path = thumbnailPath(p_path, p_width);
+    if (path.isEmpty()) {
+        return;
+    }
+
+    QByteArray pixels(reinterpret_cast<const char *>(p_image.constBits()),
+                      p_image.byteCount());
+
+    // Written to a temporary file first, so it is never read half-written.
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+
+    QDataStream out(&file);
+    out << c_magic
+        << static_cast<qint32>(p_originalWidth)
+        << static_cast<qint32>(p_image.width())
+        << static_cast<qint32>(p_image.height())
+        << static_cast<qint32>(p_image.format())
+        << qCompress(pixels, 1);
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "fail to write thumbnail" << path;
+        return;
+    }
+
+    QMutexLocker locker(&s_mutex);
+    if (s_totalSize >= 0) {
+        s_totalSize += QFileInfo(path).size();
+    }
+
+    if (s_totalSize < 0 || s_totalSize > s_budget) {
+        collectGarbage();
+    }
+}
+
+void VThumbnailCache::collectGarbage()
+{
+    QDir dir(s_folder);
+    QFileInfoList files = dir.entryInfoList(QStringList() << QString("*") + c_suffix,
+                                            QDir::Files,
+                                            QDir::Time | QDir::Reversed);
+    s_totalSize = 0;
+    for (auto const & info : files) {
+        s_totalSize += info.size();
+    }
+
+    if (s_totalSize <= s_budget) {
+        return;
+    }
+
+    // Oldest first.
+    qint64 target = s_budget * c_gcRatio;
+    for (auto const & info : files) {
+        if (s_totalSize <= target) {
+            break;
+        }
+
+        if (dir.remove(info.fileName())) {
+            s_totalSize -= info.size();
+        }
+    }
+
+    qDebug() << "thumbnail cache collected to" << s_totalSize << "bytes";
+}
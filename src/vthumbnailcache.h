@@ -0,0 +1,61 @@
+#ifndef VTHUMBNAILCACHE_H
+#define VTHUMBNAILCACHE_H
+
+#include <QString>
+#include <QImage>
+#include <QMutex>
+
+// Downscaled images kept on disk across sessions, so reopening a note does not
+// decode its images again. A thumbnail is keyed by the hash of the canonical
+// path, size and modification time of the image and the width it is scaled
+// to, and stored as raw pixels compressed lightly, which is much cheaper to
+// load than decoding a PNG or JPEG. The oldest thumbnails are removed beyond
+// the budget of thumbnail_cache_size MB.
+// Thread-safe after init().
+class VThumbnailCache
+{
+public:
+    // Read the folder and budget from the configuration. Call it in the GUI
+    // thread before using the cache.
+    static void init();
+
+    // Load the thumbnail of the image file @p_path scaled to @p_width.
+    // @p_originalWidth will be the width of the image. Return a null image if
+    // there is none.
+    static QImage load(const QString &p_path, int p_width, int &p_originalWidth);
+
+    // Store @p_image as the thumbnail of @p_path scaled to @p_width.
+    static void store(const QString &p_path, int p_width,
+                      const QImage &p_image, int p_originalWidth);
+
+    static bool isEnabled();
+
+private:
+    // Path of the thumbnail file. Empty if @p_path does not exist.
+    static QString thumbnailPath(const QString &p_path, int p_width);
+
+    // Remove the oldest thumbnails until the total size is within the budget.
+    // Must hold s_mutex.
+    static void collectGarbage();
+
+    static QMutex s_mutex;
+
+    static QString s_folder;
+
+    // Budget in bytes. 0 if the cache is disabled.
+    static qint64 s_budget;
+
+    // Total bytes of the thumbnails. -1 if not computed yet.
+    static qint64 s_totalSize;
+
+    // Remove thumbnails down to this ratio of the budget when collecting
+    // garbage, so it does not happen on every store.
+    static const qreal c_gcRatio;
+
+    // Stamp of the file format.
+    static const quint32 c_magic;
+
+    static const char *c_suffix;
+};
+
+#endif // VTHUMBNAILCACHE_H